@@ -0,0 +1,339 @@
+// Copyright [2022] <Devansh Goenka>
+
+// Prebuilt dictionary index shared by my-look and wordle.
+//
+// The index holds every non-empty line of a dictionary along with its
+// normalized key (alphanumeric characters only, lower case) and a 64-bit
+// signature of the bytes it contains. Entries are stored in file order,
+// followed by their positions sorted by key, so my-look can binary search
+// a prefix and wordle can reject a word with an AND, both straight out of
+// a read-only mapping of the index file.
+//
+// Layout: header, entries[count], sorted[count], keys, lines.
+// This is header-only and compiles as C (my-look) and C++ (wordle).
+
+#ifndef P1_DICT_INDEX_H_
+#define P1_DICT_INDEX_H_
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<string.h>
+#include<ctype.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+
+// "DICTIDX1" read as a native integer, an index from a machine with the
+// other byte order fails the check instead of being misread
+#define DICT_INDEX_MAGIC 0x3158444954434944ULL
+
+struct dict_index_header {
+    uint64_t magic;
+    uint64_t count;         // number of entries
+    uint64_t keys_off;      // offset of the key bytes
+    uint64_t lines_off;     // offset of the line bytes
+    uint64_t size;          // size of the whole index file
+};
+
+struct dict_index_entry {
+    uint64_t line_off;      // line bytes, relative to the lines section
+    uint64_t key_off;       // key bytes, relative to the keys section
+    uint32_t line_len;      // without the newline
+    uint32_t key_len;
+    uint64_t letters;       // DICT_INDEX_LETTER of every byte in the line
+};
+
+// Signature bit of a byte, taken modulo 64, so different bytes can share a bit
+// ('0'..'9' land on the same bits as 'p'..'y', for one). The signature
+// only rules lines out, a shared bit just costs an exact check of the line
+#define DICT_INDEX_LETTER(c) (1ULL << ((c) & 63))
+
+struct dict_index {
+    const char* map;
+    size_t size;
+    uint64_t count;
+    const struct dict_index_entry* entries;
+    const uint32_t* sorted;     // entry positions in key order
+    const char* keys;
+    const char* lines;
+};
+
+// Key of a line: its alphanumeric characters in lower case
+static inline uint32_t dict_index_normalize(const char* line, size_t len,
+        char* key) {
+    uint32_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char) line[i];
+        if (isalnum(c)) {
+            key[n++] = (char) tolower(c);
+        }
+    }
+    return n;
+}
+
+// Compares a key against a normalized prefix, 0 if the key starts with it
+static inline int dict_index_compare(const char* key, uint32_t key_len,
+        const char* prefix, uint32_t prefix_len) {
+    uint32_t n = key_len < prefix_len ? key_len : prefix_len;
+    int diff = memcmp(key, prefix, n);
+    if (diff != 0) {
+        return diff;
+    }
+    return key_len < prefix_len ? -1 : 0;
+}
+
+// Keys blob and entries used by the qsort comparator while building
+static const char* dict_index_sort_keys;
+static const struct dict_index_entry* dict_index_sort_entries;
+
+static inline int dict_index_sort_cmp(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+    const struct dict_index_entry* ex = &dict_index_sort_entries[x];
+    const struct dict_index_entry* ey = &dict_index_sort_entries[y];
+
+    uint32_t n = ex->key_len < ey->key_len ? ex->key_len : ey->key_len;
+    int diff = memcmp(dict_index_sort_keys + ex->key_off,
+            dict_index_sort_keys + ey->key_off, n);
+    if (diff != 0) {
+        return diff;
+    }
+    if (ex->key_len != ey->key_len) {
+        return ex->key_len < ey->key_len ? -1 : 1;
+    }
+
+    // Equal keys keep their file order
+    return x < y ? -1 : x > y;
+}
+
+static inline int dict_index_write(int fd, const void* buf, size_t len) {
+    const char* p = (const char*) buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Builds an index of a dictionary file, returns 0 on success
+static inline int dict_index_build(const char* dict_name,
+        const char* index_name) {
+    FILE* fp = fopen(dict_name, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fileno(fp), &st) < 0) {
+        fclose(fp);
+        return -1;
+    }
+
+    // Lines and keys never outgrow the dictionary itself
+    size_t cap = st.st_size + 1;
+    char* lines = (char*) malloc(cap);
+    char* keys = (char*) malloc(cap);
+    size_t entries_cap = 1024;
+    struct dict_index_entry* entries = (struct dict_index_entry*)
+            malloc(entries_cap * sizeof(struct dict_index_entry));
+    if (lines == NULL || keys == NULL || entries == NULL) {
+        fclose(fp);
+        free(lines);
+        free(keys);
+        free(entries);
+        return -1;
+    }
+
+    size_t lines_len = fread(lines, 1, st.st_size, fp);
+    fclose(fp);
+
+    uint64_t count = 0;
+    size_t keys_len = 0;
+    size_t start = 0;
+    while (start < lines_len) {
+        const char* nl = (const char*) memchr(lines + start, '\n',
+                lines_len - start);
+        size_t end = nl == NULL ? lines_len : (size_t) (nl - lines);
+
+        // Empty lines never match anything in either tool
+        if (end > start) {
+            if (count == entries_cap) {
+                entries_cap *= 2;
+                struct dict_index_entry* grown = (struct dict_index_entry*)
+                        realloc(entries,
+                        entries_cap * sizeof(struct dict_index_entry));
+                if (grown == NULL) {
+                    free(lines);
+                    free(keys);
+                    free(entries);
+                    return -1;
+                }
+                entries = grown;
+            }
+
+            struct dict_index_entry* entry = &entries[count++];
+            memset(entry, 0, sizeof(*entry));
+            entry->line_off = start;
+            entry->line_len = end - start;
+            entry->key_off = keys_len;
+            entry->key_len = dict_index_normalize(lines + start, end - start,
+                    keys + keys_len);
+            keys_len += entry->key_len;
+
+            for (size_t i = start; i < end; i++) {
+                unsigned char c = (unsigned char) lines[i];
+                entry->letters |= DICT_INDEX_LETTER(c);
+            }
+        }
+
+        start = end + 1;
+    }
+
+    // Sorted positions are 32-bit
+    uint32_t* sorted = count > UINT32_MAX ? NULL :
+            (uint32_t*) malloc(count * sizeof(uint32_t) + 1);
+    if (sorted == NULL) {
+        free(lines);
+        free(keys);
+        free(entries);
+        return -1;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        sorted[i] = i;
+    }
+    dict_index_sort_keys = keys;
+    dict_index_sort_entries = entries;
+    qsort(sorted, count, sizeof(uint32_t), dict_index_sort_cmp);
+
+    struct dict_index_header header;
+    header.magic = DICT_INDEX_MAGIC;
+    header.count = count;
+    header.keys_off = sizeof(header) + count * sizeof(struct dict_index_entry)
+            + count * sizeof(uint32_t);
+    // The lines section starts 8-byte aligned
+    header.lines_off = header.keys_off + ((keys_len + 7) & ~(size_t) 7);
+    header.size = header.lines_off + lines_len;
+
+    int rc = -1;
+    int fd = open(index_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        static const char zeros[8] = {0};
+        rc = dict_index_write(fd, &header, sizeof(header));
+        if (rc == 0) {
+            rc = dict_index_write(fd, entries,
+                    count * sizeof(struct dict_index_entry));
+        }
+        if (rc == 0) {
+            rc = dict_index_write(fd, sorted, count * sizeof(uint32_t));
+        }
+        if (rc == 0) {
+            rc = dict_index_write(fd, keys, keys_len);
+        }
+        if (rc == 0) {
+            rc = dict_index_write(fd, zeros,
+                    header.lines_off - header.keys_off - keys_len);
+        }
+        if (rc == 0) {
+            rc = dict_index_write(fd, lines, lines_len);
+        }
+        if (close(fd) < 0) {
+            rc = -1;
+        }
+    }
+
+    free(lines);
+    free(keys);
+    free(entries);
+    free(sorted);
+    return rc;
+}
+
+// Maps an index built by dict_index_build, returns 0 on success
+static inline int dict_index_open(const char* index_name,
+        struct dict_index* index) {
+    int fd = open(index_name, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size <
+            sizeof(struct dict_index_header)) {
+        close(fd);
+        return -1;
+    }
+
+    const char* map = (const char*) mmap(NULL, st.st_size, PROT_READ,
+            MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    // Refuse anything that is not a complete index from this machine
+    const struct dict_index_header* header =
+            (const struct dict_index_header*) map;
+    if (header->magic != DICT_INDEX_MAGIC ||
+            header->size != (uint64_t) st.st_size ||
+            header->keys_off > header->lines_off ||
+            header->lines_off > header->size ||
+            header->count > (header->keys_off - sizeof(*header)) /
+            (sizeof(struct dict_index_entry) + sizeof(uint32_t))) {
+        munmap((void*) map, st.st_size);
+        return -1;
+    }
+
+    index->map = map;
+    index->size = st.st_size;
+    index->count = header->count;
+    index->entries = (const struct dict_index_entry*) (header + 1);
+    index->sorted = (const uint32_t*) (index->entries + header->count);
+    index->keys = map + header->keys_off;
+    index->lines = map + header->lines_off;
+    return 0;
+}
+
+static inline void dict_index_close(struct dict_index* index) {
+    munmap((void*) index->map, index->size);
+}
+
+// Finds the range [*first, *last) of sorted positions whose key starts
+// with the normalized prefix
+static inline void dict_index_prefix(const struct dict_index* index,
+        const char* prefix, uint32_t prefix_len,
+        uint64_t* first, uint64_t* last) {
+    uint64_t lo = 0;
+    uint64_t hi = index->count;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        const struct dict_index_entry* e = &index->entries[index->sorted[mid]];
+        if (dict_index_compare(index->keys + e->key_off, e->key_len,
+                prefix, prefix_len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *first = lo;
+
+    hi = index->count;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        const struct dict_index_entry* e = &index->entries[index->sorted[mid]];
+        if (dict_index_compare(index->keys + e->key_off, e->key_len,
+                prefix, prefix_len) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *last = lo;
+}
+
+#endif  // P1_DICT_INDEX_H_
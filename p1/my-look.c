@@ -5,9 +5,304 @@
 #include<getopt.h>
 #include<ctype.h>
 #include<string.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include "dict-index.h"
 
 #define BUFFERSIZE 256
 
+// Compares the alphanumeric characters of a line against the search prefix,
+// ignoring case. Returns < 0 if the line sorts before the prefix, 0 if it
+// starts with it and > 0 if it sorts after it.
+int compare_line(const char* line, const char* end, const char* search) {
+    while (*search != '\0') {
+        // Skip over the characters the comparison ignores
+        while (line < end && !isalnum((unsigned char) *line)) {
+            line++;
+        }
+
+        // The line ran out first, so it sorts before the prefix
+        if (line == end) {
+            return -1;
+        }
+
+        int diff = tolower((unsigned char) *line) - tolower((unsigned char) *search);
+        if (diff != 0) {
+            return diff;
+        }
+        line++;
+        search++;
+    }
+
+    return 0;
+}
+
+// Finds the start of the line holding offset pos
+const char* line_start(const char* data, const char* pos) {
+    while (pos > data && pos[-1] != '\n') {
+        pos--;
+    }
+    return pos;
+}
+
+// Finds the end of the line starting at pos, not counting the \n
+const char* line_end(const char* pos, const char* end) {
+    const char* nl = memchr(pos, '\n', end - pos);
+    return nl == NULL ? end : nl;
+}
+
+// Looks up the search prefix in a sorted file by binary search, like BSD
+// look, and prints only the range of lines that match
+int binary_look(const char* file_name, const char* search) {
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0) {
+        printf("my-look: cannot open file\n");
+        exit(1);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        printf("my-look: cannot open file\n");
+        exit(1);
+    }
+
+    // Nothing to map in an empty file
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    const char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        printf("my-look: cannot map file\n");
+        exit(1);
+    }
+    const char* end = data + st.st_size;
+
+    // The search touches a few scattered pages, read-ahead would only waste I/O
+    madvise((void*) data, st.st_size, MADV_RANDOM);
+
+    // Narrow [lo, hi) down to the first line not sorting before the prefix
+    const char* lo = data;
+    const char* hi = end;
+    while (lo < hi) {
+        const char* mid = line_start(data, lo + (hi - lo) / 2);
+        const char* mid_end = line_end(mid, end);
+
+        if (compare_line(mid, mid_end, search) < 0) {
+            lo = mid_end < end ? mid_end + 1 : end;
+        } else {
+            hi = mid;
+        }
+    }
+
+    // Print every matching line, the first one that does not ends the range
+    while (lo < end) {
+        const char* eol = line_end(lo, end);
+
+        if (compare_line(lo, eol, search) != 0) {
+            break;
+        }
+
+        // Empty lines are skipped like in the streaming mode
+        if (eol > lo) {
+            fwrite(lo, 1, eol - lo, stdout);
+            putchar('\n');
+        }
+        lo = eol + 1;
+    }
+
+    munmap((void*) data, st.st_size);
+    close(fd);
+
+    return 0;
+}
+
+// Orders sorted positions back into file order
+int compare_position(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+// Answers the search from a prebuilt index, printing the matches in the
+// order they appear in the dictionary like the other modes do
+int index_look(const char* index_name, const char* search) {
+    struct dict_index index;
+    if (dict_index_open(index_name, &index) < 0) {
+        printf("my-look: cannot open index\n");
+        exit(1);
+    }
+
+    char prefix[BUFFERSIZE];
+    uint32_t prefix_len = dict_index_normalize(search, strlen(search), prefix);
+
+    uint64_t first, last;
+    dict_index_prefix(&index, prefix, prefix_len, &first, &last);
+
+    uint64_t count = last - first;
+    uint32_t* matches = malloc(count * sizeof(uint32_t) + 1);
+    if (matches == NULL) {
+        printf("my-look: out of memory\n");
+        exit(1);
+    }
+    memcpy(matches, index.sorted + first, count * sizeof(uint32_t));
+    qsort(matches, count, sizeof(uint32_t), compare_position);
+
+    for (uint64_t i = 0; i < count; i++) {
+        const struct dict_index_entry* entry = &index.entries[matches[i]];
+        fwrite(index.lines + entry->line_off, 1, entry->line_len, stdout);
+        putchar('\n');
+    }
+
+    free(matches);
+    dict_index_close(&index);
+
+    return 0;
+}
+
+// One search of a batch, with the lines it matched so far
+struct query {
+    char key[BUFFERSIZE];   // normalized prefix
+    uint32_t len;
+    char* out;
+    size_t out_len;
+    size_t out_cap;
+};
+
+// Orders queries by prefix length, then by prefix
+struct query* sort_queries;
+
+int compare_query(const void* a, const void* b) {
+    const struct query* x = &sort_queries[*(const uint32_t*) a];
+    const struct query* y = &sort_queries[*(const uint32_t*) b];
+    if (x->len != y->len) {
+        return x->len < y->len ? -1 : 1;
+    }
+    return memcmp(x->key, y->key, x->len);
+}
+
+// Adds a matched line to the output of a query
+void add_match(struct query* q, const char* line, size_t len) {
+    if (q->out_len + len + 1 > q->out_cap) {
+        q->out_cap = q->out_cap ? q->out_cap * 2 : 4096;
+        while (q->out_len + len + 1 > q->out_cap) {
+            q->out_cap *= 2;
+        }
+        q->out = realloc(q->out, q->out_cap);
+        if (q->out == NULL) {
+            printf("my-look: out of memory\n");
+            exit(1);
+        }
+    }
+    memcpy(q->out + q->out_len, line, len);
+    q->out[q->out_len + len] = '\n';
+    q->out_len += len + 1;
+}
+
+// Answers every search prefix in query_name with one pass over the
+// dictionary. The queries are sorted by length and prefix, so each line
+// only binary searches them once per distinct prefix length. Matches are
+// printed query by query, each followed by an empty line.
+int batch_look(FILE* fp, const char* query_name) {
+    FILE* qp = fopen(query_name, "r");
+    if (qp == NULL) {
+        printf("my-look: cannot open query file\n");
+        exit(1);
+    }
+
+    struct query* queries = NULL;
+    uint32_t nqueries = 0;
+    uint32_t cap = 0;
+    char buffer[BUFFERSIZE];
+
+    while (fgets(buffer, BUFFERSIZE, qp) != NULL) {
+        buffer[strcspn(buffer, "\n")] = 0;
+        if (nqueries == cap) {
+            cap = cap ? cap * 2 : 64;
+            queries = realloc(queries, cap * sizeof(struct query));
+            if (queries == NULL) {
+                printf("my-look: out of memory\n");
+                exit(1);
+            }
+        }
+        struct query* q = &queries[nqueries++];
+        memset(q, 0, sizeof(*q));
+        q->len = dict_index_normalize(buffer, strlen(buffer), q->key);
+    }
+    fclose(qp);
+
+    uint32_t* order = malloc(nqueries * sizeof(uint32_t) + 1);
+    if (order == NULL) {
+        printf("my-look: out of memory\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < nqueries; i++) {
+        order[i] = i;
+    }
+    sort_queries = queries;
+    qsort(order, nqueries, sizeof(uint32_t), compare_query);
+
+    // Where the queries of each prefix length start in the sorted order
+    uint32_t starts[BUFFERSIZE + 1];
+    for (uint32_t len = 0, k = 0; len <= BUFFERSIZE; len++) {
+        while (k < nqueries && queries[order[k]].len < len) {
+            k++;
+        }
+        starts[len] = k;
+    }
+
+    while (fgets(buffer, BUFFERSIZE, fp) != NULL) {
+        buffer[strcspn(buffer, "\n")] = 0;
+
+        // Empty lines are skipped like in the other modes
+        size_t line_len = strlen(buffer);
+        if (line_len == 0) {
+            continue;
+        }
+
+        char key[BUFFERSIZE];
+        uint32_t key_len = dict_index_normalize(buffer, line_len, key);
+
+        for (uint32_t len = 0; len <= key_len; len++) {
+            uint32_t lo = starts[len];
+            uint32_t hi = starts[len + 1];
+            if (lo == hi) {
+                continue;
+            }
+
+            // First query of this length not sorting before the line
+            while (lo < hi) {
+                uint32_t mid = lo + (hi - lo) / 2;
+                if (memcmp(queries[order[mid]].key, key, len) < 0) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+
+            // Equal prefixes sit next to each other
+            for (; lo < starts[len + 1] &&
+                    memcmp(queries[order[lo]].key, key, len) == 0; lo++) {
+                add_match(&queries[order[lo]], buffer, line_len);
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < nqueries; i++) {
+        fwrite(queries[i].out, 1, queries[i].out_len, stdout);
+        putchar('\n');
+        free(queries[i].out);
+    }
+
+    free(order);
+    free(queries);
+
+    return 0;
+}
+
 int main(int argc, char** argv) {
     // Setting getopt()'s error to 0, to disable printing the default error
     opterr = 0;
@@ -15,29 +310,77 @@ int main(int argc, char** argv) {
     // Initialising the file pointers
     char* file_name = NULL;
     int is_stdin = 1;
+    int is_binary = 0;
+    char* index_name = NULL;
+    char* build_name = NULL;
+    char* query_name = NULL;
 
     // Reading command line arguments
     int opt;
-    while ((opt = getopt(argc, argv, "f:Vh")) != -1) {
+    while ((opt = getopt(argc, argv, "bf:i:q:B:Vh")) != -1) {
         switch (opt) {
             case 'h':
                 printf("my-look: usage 'my-look search-term' from stdin."
-                "use -f to specify file to read from"
+                "use -f to specify file to read from, "
+                "-b to binary search a sorted file, "
+                "-B to build an index of the file, "
+                "-i to search an index, "
+                "-q to answer every search in a file at once "
                 "and -V for version information\n");
                 return 0;
             case 'V':
                 printf("my-look from CS537 Spring 2022\n");
                 return 0;
+            case 'b':
+                is_binary = 1;
+                break;
             case 'f':
                 is_stdin = 0;
                 file_name = optarg;
                 break;
+            case 'i':
+                index_name = optarg;
+                break;
+            case 'B':
+                build_name = optarg;
+                break;
+            case 'q':
+                query_name = optarg;
+                break;
             default:
                 printf("my-look: invalid command line\n");
                 exit(1);
         }
     }
 
+    // Building an index does not need a search string
+    if (build_name != NULL) {
+        if (is_stdin) {
+            printf("my-look: -B needs the file to index given with -f\n");
+            exit(1);
+        }
+        if (dict_index_build(file_name, build_name) < 0) {
+            printf("my-look: cannot build index\n");
+            exit(1);
+        }
+        return 0;
+    }
+
+    // A batch reads its search strings from the query file
+    if (query_name != NULL) {
+        FILE* fp = stdin;
+        if (!is_stdin) {
+            fp = fopen(file_name, "r");
+            if (fp == NULL) {
+                printf("my-look: cannot open file\n");
+                exit(1);
+            }
+        }
+        batch_look(fp, query_name);
+        fclose(fp);
+        return 0;
+    }
+
     // Search string is the only required argument in the utility
     if (optind >= argc) {
         printf("my-look: search string not found, use -h on how to use\n");
@@ -63,6 +406,20 @@ int main(int argc, char** argv) {
 
     int size_search = strlen(search);
 
+    // The index answers the search without touching the dictionary
+    if (index_name != NULL) {
+        return index_look(index_name, search);
+    }
+
+    // The sorted file is searched in place instead of read line by line
+    if (is_binary) {
+        if (is_stdin) {
+            printf("my-look: -b needs a sorted file given with -f\n");
+            exit(1);
+        }
+        return binary_look(file_name, search);
+    }
+
     // Defaulting to the stdin FILE* for input
     FILE *fp = stdin;
 
@@ -92,6 +449,7 @@ int main(int argc, char** argv) {
             }
             i++;
         }
+        cmp_string[j] = '\0';
 
         // If the buffer is just a new line, skip it
         if (strlen(buffer) == 0) {
@@ -5,19 +5,425 @@
 #include<getopt.h>
 #include<ctype.h>
 #include<string.h>
+#include<stdint.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include<immintrin.h>
+#define HAVE_X86 1
+#endif
+#include "dict-index.h"
 
 #define BUFFERSIZE 255
+#define WORDLEN 5
+#define OUTBUFSIZE (1 << 20)
+
+// Bytes looked at per step of the bulk scan, one bit each in the masks
+#define BLOCKSIZE 64
+
+// The banned characters as a 256-bit bitmask, bit c & 7 of byte c >> 3
+struct banned_set {
+    uint8_t bits[32];
+};
+
+// Marks the banned bytes and the newlines of one block, scalar version
+uint64_t scan_block_scalar(const char* block, const banned_set& set,
+        uint64_t* newlines) {
+    uint64_t banned = 0;
+    *newlines = 0;
+    for (int i = 0; i < BLOCKSIZE; i++) {
+        unsigned char c = static_cast<unsigned char>(block[i]);
+        if (set.bits[c >> 3] >> (c & 7) & 1) {
+            banned |= 1ULL << i;
+        }
+        if (c == '\n') {
+            *newlines |= 1ULL << i;
+        }
+    }
+    return banned;
+}
+
+#ifdef HAVE_X86
+// Same as scan_block_scalar, 16 bytes at a time: shuffles look up the
+// bitmask byte for every character and another one picks the bit inside it.
+// A shuffle returns 0 for indexes with the top bit set, so keeping the top
+// bit of the character sends it to the table for its half of the range.
+__attribute__((target("ssse3")))
+uint64_t scan_block_ssse3(const char* block, const banned_set& set,
+        uint64_t* newlines) {
+    const __m128i low = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(set.bits));
+    const __m128i high = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(set.bits + 16));
+    const __m128i top = _mm_set1_epi8(-128);
+    const __m128i bit = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+            1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i seven = _mm_set1_epi8(7);
+    const __m128i nl = _mm_set1_epi8('\n');
+
+    uint64_t banned = 0;
+    *newlines = 0;
+    for (int i = 0; i < BLOCKSIZE; i += 16) {
+        __m128i v = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(block + i));
+
+        // Index of the bitmask byte within the half the character is in
+        __m128i index = _mm_and_si128(_mm_srli_epi16(v, 3),
+                _mm_set1_epi8(0x0f));
+        __m128i is_high = _mm_and_si128(v, top);
+        __m128i bytes = _mm_or_si128(
+                _mm_shuffle_epi8(low, _mm_or_si128(index, is_high)),
+                _mm_shuffle_epi8(high, _mm_or_si128(index,
+                        _mm_xor_si128(is_high, top))));
+        __m128i bits = _mm_shuffle_epi8(bit, _mm_and_si128(v, seven));
+        __m128i hit = _mm_cmpeq_epi8(_mm_and_si128(bytes, bits), bits);
+
+        banned |= static_cast<uint64_t>(static_cast<uint16_t>(
+                _mm_movemask_epi8(hit))) << i;
+        *newlines |= static_cast<uint64_t>(static_cast<uint16_t>(
+                _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)))) << i;
+    }
+    return banned;
+}
+#endif
+
+// Bits from..63 of a block mask
+uint64_t bits_from(int from) {
+    return from >= BLOCKSIZE ? 0 : ~0ULL << from;
+}
+
+// Reads the dictionary through mmap, classifying a block of bytes at a
+// time, and collects the surviving words in a large output buffer
+int bulk_wordle(const char* file_name, const char* blacklist) {
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0) {
+        printf("wordle: cannot open file\n");
+        exit(1);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        printf("wordle: cannot open file\n");
+        exit(1);
+    }
+
+    size_t size = st.st_size;
+    if (size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    const char* data = static_cast<const char*>(
+            mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0));
+    if (data == MAP_FAILED) {
+        printf("wordle: cannot map file\n");
+        exit(1);
+    }
+    madvise(const_cast<char*>(data), size, MADV_SEQUENTIAL);
+
+    banned_set set;
+    memset(&set, 0, sizeof(set));
+    for (int i = 0; blacklist[i] != '\0'; i++) {
+        unsigned char c = static_cast<unsigned char>(blacklist[i]);
+        set.bits[c >> 3] |= 1 << (c & 7);
+    }
+
+    uint64_t (*scan_block)(const char*, const banned_set&, uint64_t*) =
+            scan_block_scalar;
+#ifdef HAVE_X86
+    if (__builtin_cpu_supports("ssse3")) {
+        scan_block = scan_block_ssse3;
+    }
+#endif
+
+    char* out = static_cast<char*>(malloc(OUTBUFSIZE));
+    size_t out_len = 0;
+    if (out == NULL) {
+        printf("wordle: out of memory\n");
+        exit(1);
+    }
+
+    // A line is rejected if a banned byte shows up anywhere in it, carried
+    // across blocks until its newline is found
+    size_t line_start = 0;
+    uint64_t carry = 0;
+    char tail[BLOCKSIZE];
+
+    for (size_t base = 0; base < size; base += BLOCKSIZE) {
+        const char* block = data + base;
+
+        // The last partial block is padded with newlines
+        if (size - base < BLOCKSIZE) {
+            memset(tail, '\n', BLOCKSIZE);
+            memcpy(tail, block, size - base);
+            block = tail;
+        }
+
+        uint64_t newlines;
+        uint64_t banned = scan_block(block, set, &newlines);
+
+        while (newlines != 0) {
+            int k = __builtin_ctzll(newlines);
+            newlines &= newlines - 1;
+
+            size_t end = base + k;
+            if (end > size) {
+                break;
+            }
+
+            int from = line_start > base ? static_cast<int>(line_start - base) : 0;
+            uint64_t range = bits_from(from) & ~bits_from(k);
+            if (end - line_start == WORDLEN && !carry && !(banned & range)) {
+                if (out_len + WORDLEN + 1 > OUTBUFSIZE) {
+                    fwrite(out, 1, out_len, stdout);
+                    out_len = 0;
+                }
+                memcpy(out + out_len, data + line_start, WORDLEN);
+                out[out_len + WORDLEN] = '\n';
+                out_len += WORDLEN + 1;
+            }
+
+            line_start = end + 1;
+            carry = 0;
+        }
+
+        int from = line_start > base ? static_cast<int>(line_start - base) : 0;
+        carry |= banned & bits_from(from);
+    }
+
+    fwrite(out, 1, out_len, stdout);
+    free(out);
+
+    munmap(const_cast<char*>(data), size);
+    close(fd);
+
+    return 0;
+}
+
+// Answers from a prebuilt index: a signature of the letters of every word
+// is stored with it, so most words are settled by ANDing it with the
+// signature of the banned set and only collisions look at the word itself
+int index_wordle(const char* index_name, const char* blacklist) {
+    dict_index index;
+    if (dict_index_open(index_name, &index) < 0) {
+        printf("wordle: cannot open index\n");
+        exit(1);
+    }
+
+    int map[256] = {0};
+    uint64_t banned = 0;
+    for (int i = 0; blacklist[i] != '\0'; i++) {
+        unsigned char c = static_cast<unsigned char>(blacklist[i]);
+        map[c] = 1;
+        banned |= DICT_INDEX_LETTER(c);
+    }
+
+    char* out = static_cast<char*>(malloc(OUTBUFSIZE));
+    size_t out_len = 0;
+    if (out == NULL) {
+        printf("wordle: out of memory\n");
+        exit(1);
+    }
+
+    for (uint64_t i = 0; i < index.count; i++) {
+        const dict_index_entry& entry = index.entries[i];
+        if (entry.line_len != WORDLEN) {
+            continue;
+        }
+        const char* word = index.lines + entry.line_off;
+        if (entry.letters & banned) {
+            int is_banned = 0;
+            for (int j = 0; j < WORDLEN; j++) {
+                is_banned |= map[static_cast<unsigned char>(word[j])];
+            }
+            if (is_banned) {
+                continue;
+            }
+        }
+
+        if (out_len + WORDLEN + 1 > OUTBUFSIZE) {
+            fwrite(out, 1, out_len, stdout);
+            out_len = 0;
+        }
+        memcpy(out + out_len, word, WORDLEN);
+        out[out_len + WORDLEN] = '\n';
+        out_len += WORDLEN + 1;
+    }
+
+    fwrite(out, 1, out_len, stdout);
+    free(out);
+    dict_index_close(&index);
+
+    return 0;
+}
+
+// One banned-letter set of a batch, with the words it let through so far
+struct letter_query {
+    uint64_t banned[4];     // bit c & 63 of word c >> 6 for each banned byte
+    char* out;
+    size_t out_len;
+    size_t out_cap;
+};
+
+// Answers every banned-letter set in query_name with one pass over the
+// dictionary: each word's letters become a 256-bit mask once, and every
+// query tests it with four ANDs. Surviving words are printed query by
+// query, each followed by an empty line.
+int batch_wordle(const char* file_name, const char* query_name) {
+    FILE* qp = fopen(query_name, "r");
+    if (qp == NULL) {
+        printf("wordle: cannot open query file\n");
+        exit(1);
+    }
+
+    letter_query* queries = NULL;
+    size_t nqueries = 0;
+    size_t cap = 0;
+    char buffer[BUFFERSIZE];
+
+    while (fgets(buffer, BUFFERSIZE, qp) != NULL) {
+        buffer[strcspn(buffer, "\n")] = '\0';
+        if (nqueries == cap) {
+            cap = cap ? cap * 2 : 64;
+            queries = static_cast<letter_query*>(
+                    realloc(queries, cap * sizeof(letter_query)));
+            if (queries == NULL) {
+                printf("wordle: out of memory\n");
+                exit(1);
+            }
+        }
+        letter_query* q = &queries[nqueries++];
+        memset(q, 0, sizeof(*q));
+        for (int i = 0; buffer[i] != '\0'; i++) {
+            unsigned char c = static_cast<unsigned char>(buffer[i]);
+            q->banned[c >> 6] |= 1ULL << (c & 63);
+        }
+    }
+    fclose(qp);
+
+    FILE *fp = fopen(file_name, "r");
+    if (fp == NULL) {
+        printf("wordle: cannot open file\n");
+        exit(1);
+    }
+
+    while (fgets(buffer, BUFFERSIZE, fp) != NULL) {
+        buffer[strcspn(buffer, "\n")] = '\0';
+        if (strlen(buffer) != WORDLEN) {
+            continue;
+        }
+
+        uint64_t letters[4] = {0};
+        for (int i = 0; i < WORDLEN; i++) {
+            unsigned char c = static_cast<unsigned char>(buffer[i]);
+            letters[c >> 6] |= 1ULL << (c & 63);
+        }
+
+        for (size_t k = 0; k < nqueries; k++) {
+            letter_query* q = &queries[k];
+            if ((letters[0] & q->banned[0]) | (letters[1] & q->banned[1]) |
+                    (letters[2] & q->banned[2]) | (letters[3] & q->banned[3])) {
+                continue;
+            }
+
+            if (q->out_len + WORDLEN + 1 > q->out_cap) {
+                q->out_cap = q->out_cap ? q->out_cap * 2 : 4096;
+                q->out = static_cast<char*>(realloc(q->out, q->out_cap));
+                if (q->out == NULL) {
+                    printf("wordle: out of memory\n");
+                    exit(1);
+                }
+            }
+            memcpy(q->out + q->out_len, buffer, WORDLEN);
+            q->out[q->out_len + WORDLEN] = '\n';
+            q->out_len += WORDLEN + 1;
+        }
+    }
+    fclose(fp);
+
+    for (size_t k = 0; k < nqueries; k++) {
+        fwrite(queries[k].out, 1, queries[k].out_len, stdout);
+        putchar('\n');
+        free(queries[k].out);
+    }
+    free(queries);
+
+    return 0;
+}
 
 int main(int argc, char** argv) {
+    // Setting getopt()'s error to 0, to disable printing the default error
+    opterr = 0;
+
+    // -b reads the dictionary in bulk instead of line by line, -i reads a
+    // prebuilt index in its place and -B builds that index, -q answers
+    // every banned-letter set in a file at once
+    int is_bulk = 0;
+    int is_index = 0;
+    char* build_name = NULL;
+    char* query_name = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "biq:B:")) != -1) {
+        switch (opt) {
+            case 'b':
+                is_bulk = 1;
+                break;
+            case 'i':
+                is_index = 1;
+                break;
+            case 'B':
+                build_name = optarg;
+                break;
+            case 'q':
+                query_name = optarg;
+                break;
+            default:
+                printf("wordle: invalid command line\n");
+                exit(1);
+        }
+    }
+
+    // A batch reads its banned-letter sets from the query file
+    if (query_name != NULL) {
+        if (argc - optind != 1) {
+            printf("wordle: invalid number of args\n");
+            exit(1);
+        }
+        return batch_wordle(argv[optind], query_name);
+    }
+
+    // Building an index only needs the dictionary
+    if (build_name != NULL) {
+        if (argc - optind != 1) {
+            printf("wordle: invalid number of args\n");
+            exit(1);
+        }
+        if (dict_index_build(argv[optind], build_name) < 0) {
+            printf("wordle: cannot build index\n");
+            exit(1);
+        }
+        return 0;
+    }
+
     // Wordle needs 2 arguments the file for the dictionary and the input string
-    if (argc != 3) {
+    if (argc - optind != 2) {
         printf("wordle: invalid number of args\n");
         exit(1);
     }
 
     // Initialising the file pointers
-    char* file_name = argv[1];
-    char* blacklist = argv[2];
+    char* file_name = argv[optind];
+    char* blacklist = argv[optind + 1];
+
+    if (is_index) {
+        return index_wordle(file_name, blacklist);
+    }
+
+    if (is_bulk) {
+        return bulk_wordle(file_name, blacklist);
+    }
 
     FILE *fp = fopen(file_name, "r");
     if (fp == NULL) {
@@ -25,10 +431,10 @@ int main(int argc, char** argv) {
         exit(1);
     }
 
-    // For all ASCII characters, constructing the banned lookup map
-    int map[128] = {0};
+    // For all byte values, constructing the banned lookup map
+    int map[256] = {0};
     for (int i = 0; blacklist[i] != '\0'; i++) {
-        map[static_cast<int>(blacklist[i])] = 1;
+        map[static_cast<unsigned char>(blacklist[i])] = 1;
     }
 
     char buffer[BUFFERSIZE];
@@ -46,7 +452,7 @@ int main(int argc, char** argv) {
         int banned = 0;
         for (int i = 0; buffer[i] != '\0'; i++) {
             // The current character is banned, set the counter to 1 and break
-            if (map[static_cast<int>(buffer[i])] > 0) {
+            if (map[static_cast<unsigned char>(buffer[i])] > 0) {
                 banned = 1;
                 break;
             }
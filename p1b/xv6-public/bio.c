@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -17,6 +17,12 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Buffers are hashed by (dev, blockno) into NBUCKET buckets, each
+// a list with its own spinlock, so lookups of different blocks
+// rarely contend.  Only a miss takes bcache.lock, which serializes
+// recycling: the unused buffer with the oldest lastuse tick in any
+// bucket is moved to the bucket of the new block.
 
 #include "types.h"
 #include "defs.h"
@@ -26,70 +32,154 @@
 #include "fs.h"
 #include "buf.h"
 
-struct {
+#define NBUCKET 31
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
+  // Linked list of the bucket's buffers, through prev/next.
   struct buf head;
+};
+
+struct {
+  struct spinlock lock;  // held while recycling a buffer
+  struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+static struct bucket*
+hash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 0x9e3779b1 ^ blockno) % NBUCKET];
+}
+
+// Unlink b from its bucket.  Caller holds the bucket's lock.
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Link b at the front of a bucket.  Caller holds the bucket's lock.
+static void
+blink(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // Create the bucket lists and spread the buffers over them
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    blink(&bcache.bucket[(b - bcache.buf) % NBUCKET], b);
   }
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Look for block on device dev in its bucket and take a reference.
+// Caller holds the bucket's lock.
 static struct buf*
-bget(uint dev, uint blockno)
+bfind(struct bucket *bk, uint dev, uint blockno)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head.next; b != &bk->head; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
       return b;
     }
   }
+  return 0;
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return locked buffer.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct bucket *bk = hash(dev, blockno);
+  struct bucket *vbk, *obk;
+  struct buf *b, *victim;
+  int found;
+
+  // Is the block already cached?
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b){
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  // Not cached.  Only one process recycles at a time, so the
+  // block cannot have been added since it was last checked.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b){
+    release(&bcache.lock);
+    acquiresleep(&b->lock);
+    return b;
+  }
 
-  // Not cached; recycle an unused buffer.
+  // Recycle the least recently used unused buffer.
   // Even if refcnt==0, B_DIRTY indicates a buffer is in use
   // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // The victim's bucket stays locked until it is claimed.
+  victim = 0;
+  vbk = 0;
+  for(obk = bcache.bucket; obk < bcache.bucket+NBUCKET; obk++){
+    acquire(&obk->lock);
+    found = 0;
+    for(b = obk->head.next; b != &obk->head; b = b->next){
+      if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0 &&
+         (victim == 0 || b->lastuse < victim->lastuse)){
+        victim = b;
+        found = 1;
+      }
     }
+    if(found){
+      if(vbk)
+        release(&vbk->lock);
+      vbk = obk;
+    } else
+      release(&obk->lock);
   }
-  panic("bget: no buffers");
+  if(victim == 0)
+    panic("bget: no buffers");
+
+  victim->dev = dev;
+  victim->blockno = blockno;
+  victim->flags = 0;
+  victim->refcnt = 1;
+  bunlink(victim);
+  release(&vbk->lock);
+
+  acquire(&bk->lock);
+  blink(bk, victim);
+  release(&bk->lock);
+  release(&bcache.lock);
+
+  acquiresleep(&victim->lock);
+  return victim;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -116,28 +206,27 @@ bwrite(struct buf *b)
 }
 
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Stamp it with the time it was last used.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  // A referenced buffer is never recycled, so its bucket is stable.
+  bk = hash(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->lastuse = ticks;
   }
   
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 //PAGEBREAK!
 // Blank page.
@@ -1,6 +1,10 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
 // and pipe buffers. Allocates 4096-byte pages.
+//
+// Every CPU has its own free list, so kalloc and kfree on
+// different CPUs rarely share a lock.  A CPU whose list runs
+// dry refills it with a batch of pages from another CPU's list.
 
 #include "types.h"
 #include "defs.h"
@@ -17,12 +21,36 @@ struct run {
   struct run *next;
 };
 
-struct {
+#define KBATCH 32  // pages moved by one refill
+
+struct kmem {
   struct spinlock lock;
-  int use_lock;
   struct run *freelist;
+  uint nfree;   // pages on freelist
+  uint nalloc;  // pages allocated on this CPU
+  uint nsteal;  // pages taken from other CPUs' lists
+};
+
+struct {
+  int use_lock;
+  struct kmem cpu[NCPU];
 } kmem;
 
+// The calling CPU's free list.  Until kinit2 is done only
+// CPU 0 runs, and cpuid() does not work before mpinit().
+static struct kmem*
+mykmem(void)
+{
+  int id;
+
+  if(!kmem.use_lock)
+    return &kmem.cpu[0];
+  pushcli();
+  id = cpuid();
+  popcli();
+  return &kmem.cpu[id];
+}
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -31,7 +59,10 @@ struct {
 void
 kinit1(void *vstart, void *vend)
 {
-  initlock(&kmem.lock, "kmem");
+  struct kmem *km;
+
+  for(km = kmem.cpu; km < kmem.cpu+NCPU; km++)
+    initlock(&km->lock, "kmem");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -60,6 +91,7 @@ void
 kfree(char *v)
 {
   struct run *r;
+  struct kmem *km;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
@@ -67,13 +99,51 @@ kfree(char *v)
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
 
+  km = mykmem();
   if(kmem.use_lock)
-    acquire(&kmem.lock);
+    acquire(&km->lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  r->next = km->freelist;
+  km->freelist = r;
+  km->nfree++;
   if(kmem.use_lock)
-    release(&kmem.lock);
+    release(&km->lock);
+}
+
+// Move up to KBATCH pages from the first other CPU with free
+// pages to km's list.  Only one lock is held at a time.
+// Returns the number of pages moved.
+static int
+ksteal(struct kmem *km)
+{
+  struct kmem *victim;
+  struct run *first, *last;
+  int i, n;
+
+  for(i = 1; i < NCPU; i++){
+    victim = &kmem.cpu[(km - kmem.cpu + i) % NCPU];
+    acquire(&victim->lock);
+    n = 0;
+    first = last = victim->freelist;
+    if(first){
+      for(n = 1; n < KBATCH && last->next; n++)
+        last = last->next;
+      victim->freelist = last->next;
+      victim->nfree -= n;
+    }
+    release(&victim->lock);
+
+    if(n > 0){
+      acquire(&km->lock);
+      last->next = km->freelist;
+      km->freelist = first;
+      km->nfree += n;
+      km->nsteal += n;
+      release(&km->lock);
+      return n;
+    }
+  }
+  return 0;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +153,42 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kmem *km;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  km = mykmem();
+  for(;;){
+    if(kmem.use_lock)
+      acquire(&km->lock);
+    r = km->freelist;
+    if(r){
+      km->freelist = r->next;
+      km->nfree--;
+      km->nalloc++;
+    }
+    if(kmem.use_lock)
+      release(&km->lock);
+
+    // Refill from other CPUs; retry, since pages stolen
+    // may be taken by another process on this CPU first.
+    if(r || !kmem.use_lock || ksteal(km) == 0)
+      break;
+  }
   return (char*)r;
 }
 
+//PAGEBREAK: 10
+// Print the free and allocation counts of every CPU's list.
+// Runs when user types ^P on console.
+// No lock to avoid wedging a stuck machine further.
+void
+kmemdump(void)
+{
+  struct kmem *km;
+
+  for(km = kmem.cpu; km < kmem.cpu+NCPU; km++){
+    if(km->nfree == 0 && km->nalloc == 0 && km->nsteal == 0)
+      continue;
+    cprintf("kmem cpu%d: free %d alloc %d stolen %d\n",
+            (int)(km - kmem.cpu), km->nfree, km->nalloc, km->nsteal);
+  }
+}
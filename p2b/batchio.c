@@ -0,0 +1,186 @@
+// Copyright [2022] <Devansh Goenka>
+
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+
+#include "batchio.h"
+
+// Reads script lines without copying them. A regular file is mapped
+// privately and every line is cut in place, anything else (a terminal, a
+// pipe) is read in large chunks into a buffer that grows to fit the longest
+// line. Echoed lines are collected and written out in large writes.
+
+// size of the first read buffer, doubled whenever a line does not fit
+#define READ_SIZE       (64 * 1024)
+
+// size of the echo buffer
+#define ECHO_SIZE       (64 * 1024)
+
+static char ECHO[ECHO_SIZE];
+static size_t ECHO_LEN = 0;
+
+// sets up reading lines from fd
+void batch_open(struct batch *b, int fd) {
+    memset(b, 0, sizeof(*b));
+    b->fd = fd;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        // an empty file has no lines
+        if (st.st_size == 0) {
+            b->eof = 1;
+            return;
+        }
+
+        // lines are cut in place, the private mapping keeps that from the file
+        void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            b->buf = (char *) map;
+            b->len = st.st_size;
+            b->eof = 1;
+            return;
+        }
+    }
+
+    b->cap = READ_SIZE;
+    b->buf = (char *) malloc(b->cap);
+    if (b->buf == NULL) {
+        exit(1);
+    }
+}
+
+// fills the read buffer until it holds a whole line after pos, returns
+// the newline or NULL once the input ends without one
+static char* fill(struct batch *b) {
+    char *nl = (char *) memchr(b->buf + b->pos, '\n', b->len - b->pos);
+
+    while (nl == NULL && !b->eof) {
+        // move the partial line to the front
+        b->len -= b->pos;
+        memmove(b->buf, b->buf + b->pos, b->len);
+        b->pos = 0;
+
+        // a byte is always left for the NUL of an unterminated last line
+        if (b->cap - b->len < 2) {
+            b->cap *= 2;
+            b->buf = (char *) realloc(b->buf, b->cap);
+            if (b->buf == NULL) {
+                exit(1);
+            }
+        }
+
+        ssize_t n = read(b->fd, b->buf + b->len, b->cap - b->len - 1);
+        if (n <= 0) {
+            b->eof = 1;
+            break;
+        }
+
+        nl = (char *) memchr(b->buf + b->len, '\n', n);
+        b->len += n;
+    }
+
+    return nl;
+}
+
+// returns the next line without its newline and NUL-terminated in place,
+// its length and whether it had a newline, or NULL at the end of input
+char* batch_next(struct batch *b, size_t *len, int *newline) {
+    char *nl;
+
+    if (b->cap == 0) {
+        if (b->pos >= b->len) {
+            return NULL;
+        }
+        nl = (char *) memchr(b->buf + b->pos, '\n', b->len - b->pos);
+    }
+    else {
+        nl = fill(b);
+        if (nl == NULL && b->pos >= b->len) {
+            return NULL;
+        }
+    }
+
+    char *line = b->buf + b->pos;
+
+    if (nl != NULL) {
+        *nl = '\0';
+        *len = nl - line;
+        *newline = 1;
+        b->pos += *len + 1;
+        return line;
+    }
+
+    *len = b->len - b->pos;
+    *newline = 0;
+    b->pos = b->len;
+
+    // the read buffer has room for the NUL, the end of a mapping may not
+    if (b->cap == 0) {
+        free(b->last);
+        b->last = strndup(line, *len);
+        if (b->last == NULL) {
+            exit(1);
+        }
+        return b->last;
+    }
+
+    line[*len] = '\0';
+    return line;
+}
+
+// releases the mapping or read buffer, the fd is left open
+void batch_close(struct batch *b) {
+    if (b->cap == 0) {
+        if (b->buf != NULL) {
+            munmap(b->buf, b->len);
+        }
+    }
+    else {
+        free(b->buf);
+    }
+    free(b->last);
+    memset(b, 0, sizeof(*b));
+}
+
+// writes out the collected echo
+void echo_flush() {
+    size_t done = 0;
+
+    while (done < ECHO_LEN) {
+        ssize_t n = write(STDOUT_FILENO, ECHO + done, ECHO_LEN - done);
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+
+    ECHO_LEN = 0;
+}
+
+// collects echo for stdout, anything else written to stdout or stderr
+// (commands included) must come after echo_flush()
+void echo_write(const char *s, size_t len) {
+    if (ECHO_LEN + len > ECHO_SIZE) {
+        echo_flush();
+    }
+
+    // too large to collect
+    if (len > ECHO_SIZE) {
+        while (len > 0) {
+            ssize_t n = write(STDOUT_FILENO, s, len);
+            if (n <= 0) {
+                break;
+            }
+            s += n;
+            len -= n;
+        }
+        return;
+    }
+
+    memcpy(ECHO + ECHO_LEN, s, len);
+    ECHO_LEN += len;
+}
@@ -0,0 +1,26 @@
+// Copyright [2022] <Devansh Goenka>
+
+#ifndef __BATCHIO__
+#define __BATCHIO__
+
+#include<stddef.h>
+
+// input lines, a regular file is mapped, anything else is read in chunks
+struct batch {
+    int fd;
+    char *buf;      // mapped file or read buffer
+    size_t len;     // bytes of input in buf
+    size_t cap;     // size of the read buffer, 0 when mapped
+    size_t pos;     // start of the next line
+    int eof;        // nothing more to read into the buffer
+    char *last;     // copy of an unterminated last line of a mapped file
+};
+
+void batch_open(struct batch *, int);
+char* batch_next(struct batch *, size_t *, int *);
+void batch_close(struct batch *);
+
+void echo_write(const char *, size_t);
+void echo_flush();
+
+#endif
@@ -0,0 +1,255 @@
+// Copyright [2022] <Devansh Goenka>
+
+#include<stdlib.h>
+#include<string.h>
+#include<stdio.h>
+
+#include "hashtable.h"
+#include "node.h"
+
+// number of buckets the table starts with, doubled whenever it fills up
+#define INITIAL_BUCKETS 64
+
+// size of an arena chunk, larger aliases get a chunk of their own
+#define CHUNK_SIZE      (64 * 1024)
+
+// a chunk of the arena, nodes are carved out of it and never freed alone
+struct chunk {
+    struct chunk *prev;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+// stores the buckets of the hash table
+static struct node **BUCKETS = NULL;
+static unsigned int NBUCKETS = 0;
+static unsigned int COUNT = 0;
+
+// stores the most recently defined node, older ones are linked behind it
+static struct node *NEWEST = NULL;
+
+// stores the chunk nodes are currently carved out of
+static struct chunk *ARENA = NULL;
+
+// FNV-1a hash of a name
+static unsigned int hash(char *name) {
+    unsigned int h = 2166136261u;
+    while (*name != '\0') {
+        h ^= (unsigned char) *name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// carves size bytes out of the arena
+static void* arenaalloc(size_t size) {
+    // keep every allocation pointer aligned
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+    if (ARENA == NULL || ARENA->size - ARENA->used < size) {
+        size_t chunk_size = size > CHUNK_SIZE ? size : CHUNK_SIZE;
+        struct chunk *c = (struct chunk *) malloc(sizeof(struct chunk) + chunk_size);
+
+        if (c == NULL) {
+            // malloc() failed
+            return NULL;
+        }
+
+        c->prev = ARENA;
+        c->used = 0;
+        c->size = chunk_size;
+        ARENA = c;
+    }
+
+    void *p = ARENA->data + ARENA->used;
+    ARENA->used += size;
+    return p;
+}
+
+// doubles the number of buckets, returns -1 if malloc() fails
+static int grow() {
+    unsigned int nbuckets = NBUCKETS == 0 ? INITIAL_BUCKETS : NBUCKETS * 2;
+    struct node **buckets = (struct node **) calloc(nbuckets, sizeof(struct node *));
+
+    if (buckets == NULL) {
+        return -1;
+    }
+
+    // re-link every node into its new bucket
+    for (unsigned int i = 0; i < NBUCKETS; i++) {
+        struct node *t = BUCKETS[i];
+        while (t != NULL) {
+            struct node *next = t->next;
+            t->next = buckets[t->hash & (nbuckets - 1)];
+            buckets[t->hash & (nbuckets - 1)] = t;
+            t = next;
+        }
+    }
+
+    free(BUCKETS);
+    BUCKETS = buckets;
+    NBUCKETS = nbuckets;
+    return 0;
+}
+
+// create a new node with its name and args packed in one arena allocation
+static struct node* create(char* name, char** args) {
+    int nargs = 0;
+    size_t size = sizeof(struct node) + strlen(name) + 1;
+
+    while (args[nargs] != NULL) {
+        size += strlen(args[nargs]) + 1;
+        nargs++;
+    }
+    size += (nargs + 1) * sizeof(char *);
+
+    struct node* new_node = (struct node *) arenaalloc(size);
+
+    if (new_node == NULL) {
+        // malloc() failed
+        return NULL;
+    }
+
+    // the args vector follows the node, the strings follow the vector
+    new_node->next = NULL;
+    new_node->newer = NULL;
+    new_node->older = NULL;
+    new_node->hash = hash(name);
+    new_node->args = (char **) (new_node + 1);
+
+    char *p = (char *) (new_node->args + nargs + 1);
+    new_node->name = strcpy(p, name);
+    p += strlen(name) + 1;
+
+    for (int j = 0; j < nargs; j++) {
+        new_node->args[j] = strcpy(p, args[j]);
+        p += strlen(args[j]) + 1;
+    }
+    new_node->args[nargs] = NULL;
+
+    return new_node;
+}
+
+// finds the link pointing at the node with the given name
+static struct node** lookup(char *name, unsigned int h) {
+    if (NBUCKETS == 0)
+        return NULL;
+
+    struct node** link = &BUCKETS[h & (NBUCKETS - 1)];
+    while (*link != NULL) {
+        if ((*link)->hash == h && strcmp(name, (*link)->name) == 0)
+            break;
+        link = &(*link)->next;
+    }
+
+    return link;
+}
+
+// create a new node and add to the table
+int add(char *name, char **args) {
+    if (COUNT >= NBUCKETS && grow() < 0)
+        return -1;
+
+    struct node* new_node = create(name, args);
+    // in case malloc() fails
+    if (new_node == NULL)
+        return -1;
+
+    // if a node with same name exists, delete
+    del(name);
+
+    struct node** bucket = &BUCKETS[new_node->hash & (NBUCKETS - 1)];
+    new_node->next = *bucket;
+    *bucket = new_node;
+
+    new_node->older = NEWEST;
+    if (NEWEST != NULL)
+        NEWEST->newer = new_node;
+    NEWEST = new_node;
+
+    COUNT++;
+    return 0;
+}
+
+// find a node in the table given the name
+struct node* find(char *name) {
+    struct node** link = lookup(name, hash(name));
+
+    // if not found, NULL
+    return link == NULL ? NULL : *link;
+}
+
+// print a specific node of the table to stdout
+void printnode(struct node* t) {
+    if (t == NULL)
+        return;
+
+    printf("%s", t->name);
+
+    int k = 0;
+    while(t->args[k] != NULL) {
+        printf(" %s", t->args[k]);
+        k++;
+    }
+    printf("\n");
+
+    // flush the buffer to stdout
+    fflush(stdout);
+}
+
+// finds a node with given name and prints it
+void print(char *name) {
+    struct node* p = find(name);
+    if (p == NULL)
+        return;
+
+    printnode(p);
+}
+
+// prints the entire table to stdout, most recently defined first
+void printall() {
+    struct node *temp = NEWEST;
+
+    while(temp != NULL) {
+        printnode(temp);
+        temp = temp->older;
+    }
+}
+
+// deletes a node from the table, its arena space is reclaimed by freeall()
+int del(char *name) {
+    struct node** link = lookup(name, hash(name));
+
+    if (link == NULL || *link == NULL)
+        return 1;
+
+    struct node* t = *link;
+    *link = t->next;
+
+    // unlink from the definition order
+    if (t->newer != NULL)
+        t->newer->older = t->older;
+    else
+        NEWEST = t->older;
+    if (t->older != NULL)
+        t->older->newer = t->newer;
+
+    COUNT--;
+    return 0;
+}
+
+// deallocates the entire table and its arena
+void freeall(){
+    while (ARENA != NULL) {
+        struct chunk* prev = ARENA->prev;
+        free(ARENA);
+        ARENA = prev;
+    }
+
+    free(BUCKETS);
+    BUCKETS = NULL;
+    NBUCKETS = 0;
+    COUNT = 0;
+    NEWEST = NULL;
+}
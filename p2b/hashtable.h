@@ -1,11 +1,10 @@
 // Copyright [2022] <Devansh Goenka>
 
-#ifndef __LINKEDLIST__
-#define __LINKEDLIST__
+#ifndef __HASHTABLE__
+#define __HASHTABLE__
 
 struct node;
 
-struct node* create();
 struct node* find(char*);
 
 int add(char*, char**);
@@ -14,7 +13,6 @@ int del(char*);
 void printall();
 void print(char *);
 void printnode(struct node *);
-void freenode(struct node *);
 void freeall();
 
 #endif
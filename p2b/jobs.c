@@ -0,0 +1,95 @@
+// Copyright [2022] <Devansh Goenka>
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<sys/wait.h>
+
+#include "jobs.h"
+
+// the job table, background jobs stay here until every stage exits
+struct job JOBS[MAX_JOBS];
+
+// adds a background job, returns its job number or -1 if the table is full
+int addjob(pid_t *pids, int count, char *command) {
+    int id = 1;
+
+    // job numbers are reused once the highest ones finish, like other shells
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (JOBS[i].id >= id) {
+            id = JOBS[i].id + 1;
+        }
+    }
+
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (JOBS[i].id == 0) {
+            JOBS[i].id = id;
+            JOBS[i].running = 0;
+            for (int j = 0; j < count; j++) {
+                JOBS[i].pids[JOBS[i].running++] = pids[j];
+            }
+            JOBS[i].command = strdup(command);
+            return id;
+        }
+    }
+
+    return -1;
+}
+
+// removes a job whose stages have all exited, reporting it if asked to
+static void finishjob(struct job *j, int verbose) {
+    if (verbose) {
+        printf("[%d] Done\t%s\n", j->id, j->command);
+        fflush(stdout);
+    }
+    free(j->command);
+    j->command = NULL;
+    j->id = 0;
+}
+
+// reaps the stages of background jobs that have exited, without blocking
+void reapjobs(int verbose) {
+    for (int i = 0; i < MAX_JOBS; i++) {
+        struct job *j = &JOBS[i];
+        if (j->id == 0) {
+            continue;
+        }
+
+        for (int k = 0; k < j->running; k++) {
+            if (waitpid(j->pids[k], NULL, WNOHANG) != 0) {
+                // move the last running stage into this place
+                j->pids[k--] = j->pids[--j->running];
+            }
+        }
+
+        if (j->running == 0) {
+            finishjob(j, verbose);
+        }
+    }
+}
+
+// prints the background jobs still running
+void printjobs() {
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (JOBS[i].id != 0) {
+            printf("[%d] Running\t%s\n", JOBS[i].id, JOBS[i].command);
+        }
+    }
+    fflush(stdout);
+}
+
+// waits for every background job to finish
+void waitjobs() {
+    for (int i = 0; i < MAX_JOBS; i++) {
+        struct job *j = &JOBS[i];
+        if (j->id == 0) {
+            continue;
+        }
+
+        while (j->running > 0) {
+            waitpid(j->pids[--j->running], NULL, 0);
+        }
+        finishjob(j, 0);
+    }
+}
@@ -0,0 +1,24 @@
+// Copyright [2022] <Devansh Goenka>
+
+#ifndef __JOBS__
+#define __JOBS__
+
+#include<sys/types.h>
+
+// Most background jobs tracked at once, and stages in one pipeline
+#define MAX_JOBS    64
+#define MAX_STAGES  16
+
+struct job {
+    int id;                     // job number shown to the user, 0 if free
+    pid_t pids[MAX_STAGES];     // one process per pipeline stage
+    int running;                // stages not reaped yet
+    char *command;              // the command line as typed
+};
+
+int addjob(pid_t *, int, char *);
+void reapjobs(int);
+void printjobs();
+void waitjobs();
+
+#endif
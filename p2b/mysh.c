@@ -1,15 +1,24 @@
 // Copyright [2022] <Devansh Goenka>
 
 #include<stdio.h>
+#include<stdarg.h>
 #include<sys/wait.h>
 #include<unistd.h>
 #include<stdlib.h>
 #include<ctype.h>
 #include<string.h>
 #include<fcntl.h>
+#include<spawn.h>
+#include<sys/resource.h>
 
 #include "node.h"
-#include "linkedlist.h"
+#include "hashtable.h"
+#include "parallel.h"
+#include "jobs.h"
+#include "pathcache.h"
+#include "batchio.h"
+#include "profile.h"
+#include "server.h"
 
 // Buffer sizes
 #define BUFFER_SIZE             512
@@ -19,28 +28,61 @@
 #define dprintf(...)            if (DEBUG) { printf(__VA_ARGS__); }       
 
 // Bunch of error messages
-#define ARG_ERR                 "Usage: mysh [batch-file]\n"
+#define ARG_ERR                 "Usage: mysh [-p] [-j jobs batch-file | -s socket [batch-file] | batch-file]\n"
 #define BATCH_FILE_ERR          "Error: Cannot open file %s.\n"
 #define COMMAND_NOT_FOUND_ERR   "%s: Command not found.\n"
 #define REDIRECTION_ERR         "Redirection misformatted.\n"
 #define REDIRECT_FILE_ERR       "Cannot write to file %s.\n"
 #define ALIAS_FORBIDDEN         "alias: Too dangerous to alias that.\n"
 #define UNLALIAS_ARGS           "unalias: Incorrect number of arguments.\n"
+#define PIPELINE_ERR            "Pipeline misformatted.\n"
+#define JOBS_FULL               "Too many background jobs, waiting.\n"
+#define JOB_STARTED             "[%d] %d\n"
+#define HASH_NOT_FOUND          "hash: %s: not found\n"
+#define SOCKET_ERR              "Error: Cannot listen on %s.\n"
 
 // Bunch of Constant strings
 #define ALIAS                   "alias"
 #define UNALIAS                 "unalias"
 #define PROMPT                  "mysh> "
 #define EXIT                    "exit"
+#define JOBLIST                 "jobs"
+#define WAIT                    "wait"
+#define HASH                    "hash"
+#define HASH_RESET              "-r"
 #define DELIM                   " \t\r\n"
 #define REDIRECT                ">"
+#define PIPE                    '|'
+#define BACKGROUND              '&'
+#define JOBS                    "-j"
+#define PROFILE                 "-p"
+#define SERVER                  "-s"
+#define TIME                    "time"
 
 // Function prorotypes for ease of use
 int countargs(char **);
-int tokenize(char *, char **);
-int handleredirect(char *, char **, char **);
-void execute(int, char *, char **);
-void freemem(char *, char *, char *);
+int tokenize(char *, size_t *);
+int tokenizepipeline(char *, char **[]);
+int handleredirect(char *, char **);
+int handlebackground(char *);
+char** expandalias(char **);
+char* copyline(const char *, int);
+void error(const char *);
+void writef(int, const char *, ...);
+int shell(int, int, int, int);
+pid_t launch(int, char *, char **, int, int);
+int launchpipeline(int, char **[], int, char *, int, pid_t *);
+
+// reusable arena the tokens of every line are collected in
+char **ARGS = NULL;
+size_t ARGS_CAP = 0;
+
+// reusable copy of the line, for parallel slots and background jobs
+char *LINE = NULL;
+size_t LINE_CAP = 0;
+
+// exit status of the line being run, what a server answers it with
+int STATUS = -1;
 
 int main(int argc, char** argv) {
 
@@ -48,6 +90,46 @@ int main(int argc, char** argv) {
     char* file_name = NULL;
     int is_interactive = 1;
 
+    // number of batch commands run at once, more than 1 with -j
+    int jobs = 1;
+
+    // socket a server listens on, with -s
+    char* socket_path = NULL;
+    int is_server = 0;
+
+    // "-p" profiles every command and prints a summary at exit,
+    // "-j N batch-file" runs the batch with N commands in flight,
+    // "-s socket [batch-file]" serves lines sent to a Unix socket
+    while (argc > 1) {
+        if (strcmp(argv[1], PROFILE) == 0) {
+            profile_enable();
+            argv++;
+            argc--;
+        }
+        else if (argc >= 4 && strcmp(argv[1], JOBS) == 0) {
+            jobs = atoi(argv[2]);
+            argv += 2;
+            argc -= 2;
+
+            // -j needs a positive count and is followed by the batch file
+            if (jobs <= 0 || argc != 2) {
+                write(STDERR_FILENO, ARG_ERR, strlen(ARG_ERR));
+                exit(1);
+            }
+            break;
+        }
+        else if (argc >= 3 && strcmp(argv[1], SERVER) == 0) {
+            socket_path = argv[2];
+            is_server = 1;
+            argv += 2;
+            argc -= 2;
+            break;
+        }
+        else {
+            break;
+        }
+    }
+
     // print incorrect number of args to mysh
     if (argc > 2) {
         write(STDERR_FILENO, ARG_ERR, strlen(ARG_ERR));
@@ -60,54 +142,139 @@ int main(int argc, char** argv) {
         file_name = argv[1];
     }
 
-    // Defaulting to the stdin FILE* for input
-    FILE *fp = stdin;
+    // output of parallel commands is put back in script order
+    int is_parallel = !is_interactive && jobs > 1;
+    if (is_parallel) {
+        parallel_init(jobs);
+    }
+
+    // a server listens before running its batch file, so clients can
+    // connect while it sets up
+    int listener = -1;
+    if (is_server) {
+        listener = server_listen(socket_path);
+        if (listener < 0) {
+            writef(STDERR_FILENO, SOCKET_ERR, socket_path);
+            exit(1);
+        }
+    }
+
+    // Defaulting to stdin for input
+    int fd = STDIN_FILENO;
 
     // Read from the batch file
     if (!is_interactive) {
-        fp = fopen(file_name, "r");
+        fd = open(file_name, O_RDONLY | O_CLOEXEC);
 
         // unable to read batch file
-        if (fp == NULL) {
-            char buffer[BUFFER_SIZE];
-            size_t length = snprintf(buffer, sizeof(buffer), BATCH_FILE_ERR, file_name);
-            write(STDERR_FILENO, buffer, length);
+        if (fd < 0) {
+            writef(STDERR_FILENO, BATCH_FILE_ERR, file_name);
             exit(1);
         }
     }
 
-    char buffer[BUFFER_SIZE];
+    // run the batch file, or what a server sets up before serving
+    int exited = 0;
+    if (!is_server || !is_interactive) {
+        exited = shell(fd, is_interactive, is_parallel, 0);
+    }
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+
+    // a server answers every connection in a worker of its own, which
+    // starts out with the aliases and paths set up so far
+    if (is_server && !exited) {
+        int conn = server_accept(listener);
+        shell(conn, 0, 0, 1);
+        close(conn);
+    }
+
+    // the profile summary comes after everything the commands wrote
+    profile_print();
+
+    // free alias table
+    freeall();
+    pathfree();
+    free(ARGS);
+    free(LINE);
+
+    return 0;
+}
+
+// runs the lines read from fd until the input ends or "exit", returns 1
+// if it was "exit", a server answers every line with its status and output
+int shell(int fd, int is_interactive, int is_parallel, int is_server) {
+    // lines are handed out in place, without their newline
+    struct batch input;
+    batch_open(&input, fd);
+
+    char *buffer;
+    size_t length;
+    int newline;
 
     // Print prompt
     if (is_interactive) {
         write(STDOUT_FILENO, PROMPT, strlen(PROMPT));
     }
 
+    // status of the line before, -1 until a line was read
+    STATUS = -1;
+    int exited = 0;
+
     // Reading user input until Ctrl + D signal sent
-    while (fgets(buffer, BUFFER_SIZE, fp) != NULL) {
+    while (1) {
+        // a server answers every line before reading the next one
+        if (is_server && STATUS >= 0) {
+            server_reply(fd, STATUS);
+        }
+
+        if ((buffer = batch_next(&input, &length, &newline)) == NULL) {
+            break;
+        }
+
         // variable to decide if to execute or not later
         int execute_command = 1;
+        STATUS = 0;
+
+        // collect background jobs that finished, announcing them interactively
+        reapjobs(is_interactive);
 
-        // Print the command received in batch mode only
-        if (!is_interactive) {
-            write(STDOUT_FILENO, buffer, strlen(buffer));
+        // Print the command received in batch mode only, parallel batches
+        // print it when the command's output is written out
+        char *line = NULL;
+        if (is_parallel) {
+            line = copyline(buffer, newline);
         }
+        else if (!is_interactive && !is_server) {
+            echo_write(buffer, length);
+            if (newline) {
+                echo_write("\n", 1);
+            }
+        }
+
+        // a trailing "&" runs the command in the background, parallel
+        // batches run everything concurrently already and a server answers
+        // every line once it is done
+        int is_background = handlebackground(buffer) && !is_parallel && !is_server;
 
-        // Removing the extra \n added by fgets()
-        buffer[strcspn(buffer, "\n")] = 0;
+        // the job table and the profile keep the text, the buffer gets
+        // tokenized in place
+        if (!is_parallel && (is_background || profile_enabled())) {
+            line = copyline(buffer, 0);
+        }
 
         // If the buffer is just a new line, skip it
-        if (strlen(buffer) == 0) {
+        if (buffer[0] == '\0') {
             execute_command = 0;
         }
 
         // check for redirect scenario
         int is_redirect = 0;
         char* redirect_file = NULL;
-        char* command_tokenizer = strdup(buffer);
 
-        // call redirect handler
-        int redir = handleredirect(buffer, &redirect_file, &command_tokenizer);
+        // call redirect handler, it cuts the buffer at the redirect symbol
+        int redir = handleredirect(buffer, &redirect_file);
 
         // successful case of redirection
         if (redir == 0) {
@@ -115,48 +282,88 @@ int main(int argc, char** argv) {
         }
         // bad use of redirection, print to stderr and not execute command
         else if (redir == 1) {
-            write(STDERR_FILENO, REDIRECTION_ERR, strlen(REDIRECTION_ERR));
+            error(REDIRECTION_ERR);
             execute_command = 0;
         }
 
-        // Constructing argument array for the child command
-        char *argv[100];
+        // Constructing argument arrays for every stage of the pipeline
+        char **stages[MAX_STAGES];
+
+        // tokenize every stage and get the len of the first one's args
+        int nstages = tokenizepipeline(buffer, stages);
+        char **argv = nstages > 0 ? stages[0] : NULL;
+
+        // a leading "time" reports the usage of the rest of the line
+        int is_timed = nstages > 0 && strcmp(argv[0], TIME) == 0;
+        if (is_timed) {
+            argv = ++stages[0];
+        }
 
-        // tokenize and get the len of args array
-        int len = tokenize(command_tokenizer, argv);
+        int len = nstages > 0 ? countargs(argv) + 1 : 0;
 
+        // an empty stage or too many of them
+        if (nstages < 0 && execute_command) {
+            error(PIPELINE_ERR);
+            execute_command = 0;
+        }
         // if no arguments populated, no command given
-        if(len == 0) {
+        else if(len == 0 || argv[0] == NULL) {
             execute_command = 0;
 
+            // nothing to time
+            if (is_timed && nstages == 1 && !is_redirect) {
+                struct usage usage;
+                usage_start(&usage);
+                usage_stop(&usage);
+                echo_flush();
+                usage_print(&usage);
+            }
+
             // bad use of redirection, no command given
             if (is_redirect) {
-                write(STDERR_FILENO, REDIRECTION_ERR, strlen(REDIRECTION_ERR));
+                error(REDIRECTION_ERR);
             }
         }
 
         // deciding to not execute command
         if (!execute_command) {
+            if (is_parallel) {
+                parallel_echo(line);
+            }
+
             // Printing the prompt again
             if (is_interactive) {
                 write(STDOUT_FILENO, PROMPT, strlen(PROMPT));
             }
 
-            freemem(redirect_file, command_tokenizer, NULL);
-
             continue;
         }
 
+        // built-ins only run on their own, never as a pipeline stage
+        int is_builtin = nstages == 1 &&
+                         (strcmp(argv[0], EXIT) == 0 ||
+                          strcmp(argv[0], ALIAS) == 0 ||
+                          strcmp(argv[0], UNALIAS) == 0 ||
+                          strcmp(argv[0], JOBLIST) == 0 ||
+                          strcmp(argv[0], WAIT) == 0 ||
+                          strcmp(argv[0], HASH) == 0);
+
+        // built-ins see the effects of every command before them
+        if (is_parallel && is_builtin) {
+            parallel_drain();
+            write(STDOUT_FILENO, line, strlen(line));
+        }
+
         // built-in command : "exit"
-        if (strcmp(argv[0], EXIT) == 0) {
-            freemem(redirect_file, command_tokenizer, NULL);
+        if (is_builtin && strcmp(argv[0], EXIT) == 0) {
+            exited = 1;
             break;
         }
         // built-in command : "alias"
-        else if (strcmp(argv[0], ALIAS) == 0) {
+        else if (is_builtin && strcmp(argv[0], ALIAS) == 0) {
             int count = countargs(argv);
 
-            // args >= 2, add node to alias list
+            // args >= 2, add node to alias table
             if (count >= 2) {
                 // check for forbidden aliases
 
@@ -164,7 +371,7 @@ int main(int argc, char** argv) {
                     strcmp(argv[1], UNALIAS) == 0 || 
                     strcmp(argv[1], EXIT) == 0 )  {
 
-                    write(STDERR_FILENO, ALIAS_FORBIDDEN, strlen(ALIAS_FORBIDDEN));
+                    error(ALIAS_FORBIDDEN);
                 }
                 else {
                     add(argv[1], &argv[2]);
@@ -172,10 +379,12 @@ int main(int argc, char** argv) {
             }
             // find and print the matching node
             else if (count == 1) {
+                echo_flush();
                 print(argv[1]);
             }
             // print the entire list
             else {
+                echo_flush();
                 printall();
             }
 
@@ -183,18 +392,17 @@ int main(int argc, char** argv) {
                 write(STDOUT_FILENO, PROMPT, strlen(PROMPT));
             }
 
-            freemem(redirect_file, command_tokenizer, NULL);
             continue;
         }
         // built-in command : "unalias"
-        else if (strcmp(argv[0], UNALIAS) == 0) {
+        else if (is_builtin && strcmp(argv[0], UNALIAS) == 0) {
             int count = countargs(argv);
 
             // only 1 arg expected
             if (count > 1 || count == 0) {
-                write(STDERR_FILENO, UNLALIAS_ARGS, strlen(UNLALIAS_ARGS));
+                error(UNLALIAS_ARGS);
             }
-            // remove node from alias list
+            // remove node from alias table
             else {
                 del(argv[1]);
             }
@@ -203,196 +411,434 @@ int main(int argc, char** argv) {
                 write(STDOUT_FILENO, PROMPT, strlen(PROMPT));
             }
 
-            freemem(redirect_file, command_tokenizer, NULL);
             continue;
         }
 
-        // check alias list to check if present
-        struct node* t = find(argv[0]);
+        // built-in command : "jobs"
+        else if (is_builtin && strcmp(argv[0], JOBLIST) == 0) {
+            echo_flush();
+            reapjobs(is_interactive);
+            printjobs();
 
-        // found an alias, re-populate argv
-        if (t != NULL) {
-            int i = 0;
-            int j = 0;
-            while (t->args[j] != NULL) {
-                argv[i++] = t->args[j++];
+            if (is_interactive) {
+                write(STDOUT_FILENO, PROMPT, strlen(PROMPT));
             }
-            argv[i] = NULL;
+
+            continue;
         }
+        // built-in command : "wait"
+        else if (is_builtin && strcmp(argv[0], WAIT) == 0) {
+            waitjobs();
+
+            if (is_interactive) {
+                write(STDOUT_FILENO, PROMPT, strlen(PROMPT));
+            }
+
+            continue;
+        }
+
+        // built-in command : "hash"
+        else if (is_builtin && strcmp(argv[0], HASH) == 0) {
+            echo_flush();
+
+            // print the cached commands
+            if (argv[1] == NULL) {
+                pathprint();
+            }
+            // forget every cached command
+            else if (strcmp(argv[1], HASH_RESET) == 0 && argv[2] == NULL) {
+                pathclear();
+            }
+            // look up the given commands ahead of time
+            else {
+                for (int i = 1; argv[i] != NULL; i++) {
+                    if (pathadd(argv[i]) < 0) {
+                        STATUS = 1;
+                        writef(STDERR_FILENO, HASH_NOT_FOUND, argv[i]);
+                    }
+                }
+            }
+
+            if (is_interactive) {
+                write(STDOUT_FILENO, PROMPT, strlen(PROMPT));
+            }
 
-        int pid = fork();
+            continue;
+        }
+
+        // check alias table for the command of every stage
+        for (int i = 0; i < nstages; i++) {
+            stages[i] = expandalias(stages[i]);
+        }
+
+        // the echo comes before anything the commands write
+        echo_flush();
+
+        // parallel commands write to their slot's temp file
+        int out = -1;
+        if (is_parallel) {
+            out = parallel_reserve(line);
+        }
+
+        // the wall clock of a foreground command starts before its launch
+        struct usage usage;
+        usage_start(&usage);
+
+        pid_t pids[MAX_STAGES];
+        int npids = launchpipeline(nstages, stages, is_redirect, redirect_file, out, pids);
         int status;
 
-        if (pid == 0) {
-            // Inside child, call execute
-            execute(is_redirect, redirect_file, argv);
+        if (is_parallel) {
+            // the reaper collects the last stage, which writes to the slot
+            parallel_start(npids > 0 ? pids[npids - 1] : -1, is_timed);
+        }
+        else if (is_background && npids > 0 && (status = addjob(pids, npids, line)) > 0) {
+            // the job table collects the stages later
+            if (is_interactive) {
+                writef(STDOUT_FILENO, JOB_STARTED, status, pids[npids - 1]);
+            }
         }
         else {
-            // Inside parent
-            waitpid(pid, &status, 0);
+            if (is_background && npids > 0) {
+                write(STDERR_FILENO, JOBS_FULL, strlen(JOBS_FULL));
+            }
+
+            // wait for every stage of the pipeline, adding up what they used
+            for (int i = 0; i < npids; i++) {
+                struct rusage ru;
+                if (wait4(pids[i], &status, 0, &ru) > 0) {
+                    usage_add(&usage, &ru);
+                }
+            }
+
+            // the line's status is the last stage's, if it was started
+            if (npids == nstages && npids > 0) {
+                STATUS = WIFEXITED(status) ? WEXITSTATUS(status) :
+                         WIFSIGNALED(status) ? 128 + WTERMSIG(status) : 1;
+            }
+            usage_stop(&usage);
+
+            if (is_timed && npids > 0) {
+                usage_print(&usage);
+            }
+            if (profile_enabled() && npids > 0) {
+                profile_add(line, &usage);
+            }
         }
 
         // Printing the prompt again
         if (is_interactive) {
             write(STDOUT_FILENO, PROMPT, strlen(PROMPT));
         }
-
-        freemem(redirect_file, command_tokenizer, NULL);
     }
 
-    // close file pointer
-    fclose(fp);
+    echo_flush();
 
-    // free alias list
-    freeall();
+    // wait for the commands still running and write out their output
+    if (is_parallel) {
+        parallel_drain();
+    }
 
-    return 0;
+    // the line that ended a server's connection is answered too
+    if (is_server && exited) {
+        server_reply(fd, STATUS);
+    }
+
+    batch_close(&input);
+    return exited;
 }
 
-// executes the given arguments using execv()
-void execute(int is_redirect, char* redirect_file, char** argv) {
-    // if redirection requested, handle fds
+
+// starts the given arguments with posix_spawn(), which does not copy the
+// shell's page tables the way fork() does, returns the pid or -1
+pid_t launch(int is_redirect, char* redirect_file, char** argv, int in, int out) {
+    extern char **environ;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+
+    // pipeline stages read from the previous stage and write to the next
+    // one, the last stage of a parallel batch writes to the command's slot
+    if (in >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+    }
+    if (out >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+    }
+    parallel_setattr(&attr);
+
+    // the redirect file is opened here so a failure can be told apart
+    // from a missing command, the child only gets it as stdout
+    int opfile = -1;
     if (is_redirect) {
-        // close the stdout fd
-        close(STDOUT_FILENO);
+        opfile = open(redirect_file, O_TRUNC | O_RDWR | O_CREAT | O_CLOEXEC, 0666);
 
-        // open the requested file
-        int opfile = open(redirect_file, O_TRUNC | O_RDWR | O_CREAT, 0666);
-    
         if (opfile < 0) {
             // Printing the correct error message to STDERR
-            char buffer[BUFFER_SIZE];
-            size_t length = snprintf(buffer, sizeof(buffer), REDIRECT_FILE_ERR, redirect_file);
-            write(STDERR_FILENO, buffer, length);
-            fclose(stdin);
-            exit(1);
+            writef(STDERR_FILENO, REDIRECT_FILE_ERR, redirect_file);
+            STATUS = 1;
+
+            posix_spawn_file_actions_destroy(&actions);
+            posix_spawnattr_destroy(&attr);
+            return -1;
         }
+
+        posix_spawn_file_actions_adddup2(&actions, opfile, STDOUT_FILENO);
     }
 
-    // execute the command
-    int rc = execv(argv[0], argv);
+    // execute the command, names without a "/" are looked up in PATH
+    pid_t pid;
+    char *path = pathresolve(argv[0]);
+    int rc = path == NULL ? -1 : posix_spawn(&pid, path, &actions, &attr, argv, environ);
 
-    // execv failed
+    // a cached path that went away is looked up once more
+    if (rc != 0 && path != NULL && path != argv[0]) {
+        pathforget(argv[0]);
+        path = pathresolve(argv[0]);
+        rc = path == NULL ? -1 : posix_spawn(&pid, path, &actions, &attr, argv, environ);
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (opfile >= 0) {
+        close(opfile);
+    }
+
+    // spawn failed
     if (rc != 0) {
         // Printing the correct error message to STDERR
-        char buffer[BUFFER_SIZE];
-        size_t length = snprintf(buffer, sizeof(buffer), COMMAND_NOT_FOUND_ERR, argv[0]);
-        write(STDERR_FILENO, buffer, length);
-
-        // since stdin is already open for parent
-        fclose(stdin);
-        exit(1);
+        writef(STDERR_FILENO, COMMAND_NOT_FOUND_ERR, argv[0]);
+        STATUS = 127;
+        return -1;
     }
+
+    return pid;
 }
 
-// tokenizes the command and populates the "args" array
-int tokenize(char *command_tokenizer, char **args) {
-    // Using strtok() to tokenize the string with spaces, tabs
-    char* token = strtok(command_tokenizer, DELIM);
+// starts every stage of a pipeline connected by pipes, only the last one
+// is redirected, returns the number of stages started and their pids
+int launchpipeline(int nstages, char **args[], int is_redirect, char *redirect_file, int out, pid_t *pids) {
+    int npids = 0;
+    int in = -1;
 
-    int i = 0;
+    for (int i = 0; i < nstages; i++) {
+        int last = i == nstages - 1;
+        int fds[2] = { -1, -1 };
+
+        // the shell keeps no pipe ends across the spawn of a later stage
+        if (!last) {
+            if (pipe(fds) < 0) {
+                break;
+            }
+            fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+            fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        }
 
-    // while the tokens exist
-    while(token != NULL) {
+        pid_t pid = launch(last && is_redirect, redirect_file, args[i], in, last ? out : fds[1]);
+        if (pid > 0) {
+            pids[npids++] = pid;
+        }
 
-        // Handle extra spaces and tabs
-        if (strcmp(token, DELIM) == 0) {
-            token = strtok(NULL, DELIM);
-            continue;
+        if (in >= 0) {
+            close(in);
+        }
+        if (fds[1] >= 0) {
+            close(fds[1]);
         }
+        in = fds[0];
+    }
 
-        // Construct argument array
-        args[i++] = token;
-        token = strtok(NULL, DELIM);
+    if (in >= 0) {
+        close(in);
     }
 
-    // Place NULL at the end of the argument array
-    args[i] = NULL;
+    return npids;
+}
 
-    // Return the length of tokenized args
-    return i;
+// returns the args of the command's alias, or args if it has none
+char** expandalias(char **args) {
+    struct node* t = find(args[0]);
+
+    // found an alias, it replaces the whole command
+    if (t != NULL) {
+        return t->args;
+    }
+
+    return args;
 }
 
-// handles the redirect scenario and populates "redirect_file" if true
-int handleredirect(char* buffer, char** redirect_file, char** command_tokenizer) {
-    // variables needed for redirection
-    char* before_redir = NULL;
-    char* after_redir = NULL;
-    int k = 0;
-    int pos = -1; 
-    int count = 0;
-    int is_redirect = 0;
+// copies the line into the reusable LINE buffer, with a newline if asked
+char* copyline(const char *buffer, int newline) {
+    size_t length = strlen(buffer);
 
-    // check if the redirect symbol appears in buffer
-    while (buffer[k] != 0) {
-        if (buffer[k] == '>') {
-            count++;
-            pos = k;
+    if (length + 2 > LINE_CAP) {
+        LINE_CAP = length + 2;
+        LINE = (char *) realloc(LINE, LINE_CAP);
+        if (LINE == NULL) {
+            exit(1);
         }
-        k++;
     }
 
-    // Handle case of more than 1 redirect
-    if (count > 1) {
-        // This should not happen, bad use of redirection
+    memcpy(LINE, buffer, length);
+    if (newline) {
+        LINE[length++] = '\n';
+    }
+    LINE[length] = '\0';
+
+    return LINE;
+}
+
+// writes an error message to stderr after the echo collected before it
+void error(const char *message) {
+    STATUS = 1;
+    echo_flush();
+    write(STDERR_FILENO, message, strlen(message));
+}
+
+// writes a formatted message to fd, cut short at BUFFER_SIZE - 1 bytes
+void writef(int fd, const char *format, ...) {
+    char buffer[BUFFER_SIZE];
+    va_list ap;
+    va_start(ap, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, ap);
+    va_end(ap);
+
+    // vsnprintf returns the length the whole message would have had
+    if (length < 0)
+        return;
+    if ((size_t) length >= sizeof(buffer))
+        length = sizeof(buffer) - 1;
+    write(fd, buffer, length);
+}
+
+// strips a trailing "&" off the command, returns 1 if there was one
+int handlebackground(char *buffer) {
+    int k = strlen(buffer);
+
+    // skip the trailing spaces and tabs
+    while (k > 0 && strchr(DELIM, buffer[k - 1]) != NULL) {
+        k--;
+    }
+
+    if (k > 0 && buffer[k - 1] == BACKGROUND) {
+        k--;
+        while (k > 0 && strchr(DELIM, buffer[k - 1]) != NULL) {
+            k--;
+        }
+        buffer[k] = '\0';
         return 1;
     }
-    // valid case of redirect
-    else if (count == 1) {
-        is_redirect = 1;
 
-        // separate input into before and after redirect symbol
-        before_redir = (char *) malloc((pos + 1) * sizeof(char));
-        after_redir = (char *) malloc((strlen(buffer) - pos - 1) * sizeof(char));
+    return 0;
+}
 
-        // copy input to new memory malloc()'ed
-        strncpy(before_redir, &buffer[0], pos);
-        strncpy(after_redir, &buffer[pos+1], strlen(buffer) - pos - 1);
+// splits the command at every "|" and tokenizes each stage into "args",
+// returns the number of stages, 0 for no command and -1 if misformatted
+int tokenizepipeline(char *command_tokenizer, char **args[]) {
+    char *stages[MAX_STAGES];
+    size_t starts[MAX_STAGES];
+    int nstages = 0;
+    char *stage = command_tokenizer;
+
+    // cut the command into stages in place first, strtok() is not reentrant
+    while (stage != NULL) {
+        if (nstages == MAX_STAGES) {
+            return -1;
+        }
+        stages[nstages++] = stage;
 
-        // place end of string characters
-        before_redir[pos] = '\0';
-        after_redir[strlen(buffer) - pos - 1] = '\0';
+        stage = strchr(stage, PIPE);
+        if (stage != NULL) {
+            *stage++ = '\0';
+        }
     }
 
-    if (is_redirect) {
-        // free the populated command tokenizer
-        free(*command_tokenizer);
+    size_t used = 0;
+    for (int i = 0; i < nstages; i++) {
+        starts[i] = used;
 
-        // only tokenize the commands before redir symbol;
-        *command_tokenizer = strdup(before_redir);
+        // an empty stage is fine only as the whole command
+        if (tokenize(stages[i], &used) == 0 && nstages > 1) {
+            return -1;
+        }
+    }
+
+    // the arena only stops moving once every stage is in
+    for (int i = 0; i < nstages; i++) {
+        args[i] = ARGS + starts[i];
+    }
+
+    return args[0][0] == NULL ? 0 : nstages;
+}
+
+// tokenizes the command in place into the ARGS arena from "used" on,
+// followed by a NULL, and returns the number of tokens
+int tokenize(char *command_tokenizer, size_t *used) {
+    // Using strtok() to tokenize the string with spaces, tabs
+    char* token = strtok(command_tokenizer, DELIM);
 
-        // Extracting the file name out
-        char* token = strtok(after_redir, DELIM);
+    int i = 0;
 
-        // Either empty token or more than one token
-        if (token == NULL || strtok(NULL, DELIM) != NULL) {
-            return 1;
+    // while the tokens exist, with room for the NULL after them
+    while(1) {
+        if (*used + 2 > ARGS_CAP) {
+            ARGS_CAP = ARGS_CAP == 0 ? 128 : ARGS_CAP * 2;
+            ARGS = (char **) realloc(ARGS, ARGS_CAP * sizeof(char *));
+            if (ARGS == NULL) {
+                exit(1);
+            }
         }
-        else {
-            *redirect_file = strdup(token);
+
+        if (token == NULL) {
+            break;
         }
 
-        // free the redir pointers, it is already duplicated
-        freemem(after_redir, before_redir, NULL);
-        return 0;
+        // Construct argument array
+        ARGS[(*used)++] = token;
+        i++;
+        token = strtok(NULL, DELIM);
     }
 
-    // not a redirect scenario
-    return -1;
+    // Place NULL at the end of the argument array
+    ARGS[(*used)++] = NULL;
+
+    // Return the length of tokenized args
+    return i;
 }
 
-// deallocates pointers
-void freemem(char *p1, char *p2, char *p3) {
-    if (p1 != NULL)
-        free(p1);
-    if (p2 != NULL)
-        free(p2);
-    if (p3 != NULL)
-        free(p3);
-
-    p1 = NULL;
-    p2 = NULL;
-    p3 = NULL;
+// handles the redirect scenario and points "redirect_file" into the
+// buffer, which is cut at the redirect symbol
+int handleredirect(char* buffer, char** redirect_file) {
+    // check if the redirect symbol appears in buffer
+    char *redir = strchr(buffer, '>');
+
+    // not a redirect scenario
+    if (redir == NULL) {
+        return -1;
+    }
+
+    // Handle case of more than 1 redirect
+    if (strchr(redir + 1, '>') != NULL) {
+        // This should not happen, bad use of redirection
+        return 1;
+    }
+
+    // only tokenize the commands before redir symbol
+    *redir = '\0';
+
+    // Extracting the file name out
+    char* token = strtok(redir + 1, DELIM);
+
+    // Either empty token or more than one token
+    if (token == NULL || strtok(NULL, DELIM) != NULL) {
+        return 1;
+    }
+
+    *redirect_file = token;
+    return 0;
 }
 
 // utility to count the number of arguments
@@ -4,9 +4,12 @@
 #define __NODE__
 
 struct node {
-    struct node *next;
+    struct node *next;      // next node in the same bucket
+    struct node *newer;     // node defined right after this one
+    struct node *older;     // node defined right before this one
+    unsigned int hash;
     char *name;
-    char *args[100];
+    char **args;            // NULL terminated
 };
 
-#endif
\ No newline at end of file
+#endif
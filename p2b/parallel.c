@@ -0,0 +1,212 @@
+// Copyright [2022] <Devansh Goenka>
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<signal.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<sys/wait.h>
+#include<sys/resource.h>
+
+#include "parallel.h"
+#include "profile.h"
+
+// Runs batch commands several at a time (mysh -j N). Every script line gets
+// a slot in script order holding its echo and, for commands, a temp file the
+// command's stdout goes to. Slots are written out strictly in order, so the
+// output looks the same as running the script one command at a time.
+
+// how many finished slots may wait behind a slow one, per worker
+#define BACKLOG 16
+
+struct slot {
+    pid_t pid;      // running command, 0 once reaped or if nothing ran
+    char *echo;     // the script line as read
+    int out;        // stdout of the command, -1 if it has none
+    int timed;      // the command was run with "time"
+    struct usage usage;
+};
+
+// slots between head and tail are waiting to be written out
+static struct slot *slots = NULL;
+static int capacity = 0;
+static int head = 0;
+static int tail = 0;
+
+static int workers = 1;
+static int running = 0;
+
+// set by the SIGCHLD handler, reaping happens outside of it
+static volatile sig_atomic_t child_exited = 0;
+static sigset_t wait_mask;
+
+static void onchild(int sig) {
+    (void) sig;
+    child_exited = 1;
+}
+
+// sets up the slots and the SIGCHLD reaper for n concurrent commands
+void parallel_init(int n) {
+    workers = n;
+    capacity = n * BACKLOG;
+    slots = (struct slot *) calloc(capacity, sizeof(struct slot));
+    if (slots == NULL) {
+        exit(1);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onchild;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &sa, NULL);
+
+    // SIGCHLD only gets delivered while waiting in sigsuspend()
+    sigset_t block;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &wait_mask);
+    sigdelset(&wait_mask, SIGCHLD);
+}
+
+// collects every child that has exited, marking its slot finished
+static void reap() {
+    pid_t pid;
+    struct rusage ru;
+    child_exited = 0;
+
+    while ((pid = wait4(-1, NULL, WNOHANG, &ru)) > 0) {
+        for (int i = head; i < tail; i++) {
+            struct slot *s = &slots[i % capacity];
+            if (s->pid == pid) {
+                s->pid = 0;
+                running--;
+
+                // only the last stage of a pipeline is accounted
+                if (s->timed || profile_enabled()) {
+                    usage_add(&s->usage, &ru);
+                    usage_stop(&s->usage);
+                }
+                if (s->timed) {
+                    usage_print(&s->usage);
+                }
+                if (profile_enabled()) {
+                    profile_add(s->echo, &s->usage);
+                }
+                break;
+            }
+        }
+    }
+}
+
+// writes out finished slots from the head, in script order
+static void flush() {
+    while (head < tail && slots[head % capacity].pid == 0) {
+        struct slot *s = &slots[head % capacity];
+
+        write(STDOUT_FILENO, s->echo, strlen(s->echo));
+        free(s->echo);
+
+        if (s->out >= 0) {
+            char buffer[8192];
+            ssize_t n;
+            lseek(s->out, 0, SEEK_SET);
+            while ((n = read(s->out, buffer, sizeof(buffer))) > 0) {
+                write(STDOUT_FILENO, buffer, n);
+            }
+            close(s->out);
+        }
+
+        head++;
+    }
+}
+
+// blocks until a child exits, then reaps and writes out what it can
+static void waitchild() {
+    if (!child_exited) {
+        sigsuspend(&wait_mask);
+    }
+    reap();
+    flush();
+}
+
+// opens the next slot once a worker and a place in the backlog are free
+static struct slot *next(const char *echo) {
+    flush();
+    while (tail - head == capacity) {
+        waitchild();
+    }
+
+    struct slot *s = &slots[tail % capacity];
+    s->pid = 0;
+    s->echo = strdup(echo);
+    s->out = -1;
+    s->timed = 0;
+    return s;
+}
+
+// opens a slot for a command, returns the fd its stdout should go to
+int parallel_reserve(const char *echo) {
+    while (running == workers) {
+        waitchild();
+    }
+
+    struct slot *s = next(echo);
+    usage_start(&s->usage);
+
+    // an unlinked temp file holds the output until the slot's turn
+    char name[] = "/tmp/mysh-XXXXXX";
+    s->out = mkstemp(name);
+    if (s->out >= 0) {
+        unlink(name);
+
+        // only the command of this slot gets it, as its stdout
+        fcntl(s->out, F_SETFD, FD_CLOEXEC);
+    }
+
+    tail++;
+    return s->out;
+}
+
+// records the child running the command of the last reserved slot and
+// whether its usage is printed once it exits
+void parallel_start(pid_t pid, int timed) {
+    struct slot *s = &slots[(tail - 1) % capacity];
+    if (pid > 0) {
+        s->pid = pid;
+        s->timed = timed;
+        running++;
+    }
+}
+
+// starts commands with a normal signal mask and SIGCHLD handling
+void parallel_setattr(posix_spawnattr_t *attr) {
+    // nothing to undo outside of parallel batches
+    if (slots == NULL) {
+        return;
+    }
+
+    sigset_t dfl;
+    sigemptyset(&dfl);
+    sigaddset(&dfl, SIGCHLD);
+
+    posix_spawnattr_setsigmask(attr, &wait_mask);
+    posix_spawnattr_setsigdefault(attr, &dfl);
+    posix_spawnattr_setflags(attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+}
+
+// queues the echo of a line that runs no command
+void parallel_echo(const char *echo) {
+    next(echo);
+    tail++;
+    flush();
+}
+
+// waits for every command and writes out everything still queued
+void parallel_drain() {
+    while (running > 0) {
+        waitchild();
+    }
+    reap();
+    flush();
+}
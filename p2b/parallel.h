@@ -0,0 +1,16 @@
+// Copyright [2022] <Devansh Goenka>
+
+#ifndef __PARALLEL__
+#define __PARALLEL__
+
+#include<sys/types.h>
+#include<spawn.h>
+
+void parallel_init(int);
+int parallel_reserve(const char*);
+void parallel_start(pid_t, int);
+void parallel_setattr(posix_spawnattr_t *);
+void parallel_echo(const char*);
+void parallel_drain();
+
+#endif
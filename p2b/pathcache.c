@@ -0,0 +1,271 @@
+// Copyright [2022] <Devansh Goenka>
+
+#include<stdlib.h>
+#include<string.h>
+#include<stdio.h>
+#include<time.h>
+#include<unistd.h>
+#include<limits.h>
+#include<sys/stat.h>
+
+#include "pathcache.h"
+
+// search path used when PATH is not set
+#define DEFAULT_PATH    "/bin:/usr/bin"
+
+// number of buckets of the command cache
+#define PATH_BUCKETS    256
+
+// PATH directories are stat()ed at most this often
+#define RECHECK_NSEC    1000000000L
+
+// a command resolved through PATH
+struct pathentry {
+    struct pathentry *next;
+    char *name;
+    char *path;
+    int dir;                // index of the PATH directory it was found in
+    int hits;
+};
+
+// a PATH directory and its mtime when last checked
+struct pathdir {
+    char *dir;
+    struct timespec mtime;
+};
+
+static struct pathentry *ENTRIES[PATH_BUCKETS];
+
+// stores the PATH the directories were parsed from
+static char *PATH = NULL;
+static struct pathdir *DIRS = NULL;
+static int NDIRS = 0;
+
+// stores when the directories were last stat()ed
+static struct timespec CHECKED;
+
+// FNV-1a hash of a command name
+static unsigned int hash(char *name) {
+    unsigned int h = 2166136261u;
+    while (*name != '\0') {
+        h ^= (unsigned char) *name++;
+        h *= 16777619u;
+    }
+    return h % PATH_BUCKETS;
+}
+
+// mtime of a directory, zero if it cannot be stat()ed
+static struct timespec dirmtime(char *dir) {
+    struct stat st;
+    struct timespec mtime = { 0, 0 };
+
+    if (stat(dir, &st) == 0) {
+        mtime = st.st_mtim;
+    }
+    return mtime;
+}
+
+// drops every entry found in the directory at index dir or after it
+static void drop(int dir) {
+    for (int i = 0; i < PATH_BUCKETS; i++) {
+        struct pathentry **link = &ENTRIES[i];
+        while (*link != NULL) {
+            struct pathentry *t = *link;
+            if (t->dir >= dir) {
+                *link = t->next;
+                free(t->name);
+                free(t->path);
+                free(t);
+            }
+            else {
+                link = &t->next;
+            }
+        }
+    }
+}
+
+// splits PATH into its directories, an empty one is the current directory
+static void parse(const char *path) {
+    for (int i = 0; i < NDIRS; i++) {
+        free(DIRS[i].dir);
+    }
+    free(DIRS);
+    free(PATH);
+
+    PATH = strdup(path);
+    NDIRS = 1;
+    for (const char *p = path; *p != '\0'; p++) {
+        if (*p == ':')
+            NDIRS++;
+    }
+    DIRS = (struct pathdir *) malloc(NDIRS * sizeof(struct pathdir));
+
+    const char *start = path;
+    for (int i = 0; i < NDIRS; i++) {
+        size_t len = strcspn(start, ":");
+        DIRS[i].dir = len == 0 ? strdup(".") : strndup(start, len);
+        DIRS[i].mtime = dirmtime(DIRS[i].dir);
+        start += len + 1;
+    }
+}
+
+// forgets what changed since the cache was filled, a directory that
+// changed may shadow or lose any command found in it or after it
+static void refresh() {
+    const char *path = getenv("PATH");
+    if (path == NULL)
+        path = DEFAULT_PATH;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // a different PATH starts over
+    if (PATH == NULL || strcmp(PATH, path) != 0) {
+        pathclear();
+        parse(path);
+        CHECKED = now;
+        return;
+    }
+
+    long elapsed = (now.tv_sec - CHECKED.tv_sec) * 1000000000L +
+                   (now.tv_nsec - CHECKED.tv_nsec);
+    if (elapsed < RECHECK_NSEC)
+        return;
+    CHECKED = now;
+
+    int changed = NDIRS;
+    for (int i = 0; i < NDIRS; i++) {
+        struct timespec mtime = dirmtime(DIRS[i].dir);
+        if (mtime.tv_sec != DIRS[i].mtime.tv_sec ||
+            mtime.tv_nsec != DIRS[i].mtime.tv_nsec) {
+            DIRS[i].mtime = mtime;
+            if (changed == NDIRS)
+                changed = i;
+        }
+    }
+
+    if (changed < NDIRS)
+        drop(changed);
+}
+
+// walks the PATH directories for an executable with the given name
+static struct pathentry* search(char *name) {
+    char path[PATH_MAX];
+
+    for (int i = 0; i < NDIRS; i++) {
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", DIRS[i].dir, name);
+
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode) &&
+            access(path, X_OK) == 0) {
+            struct pathentry *t = (struct pathentry *) malloc(sizeof(struct pathentry));
+            if (t == NULL)
+                return NULL;
+
+            t->name = strdup(name);
+            t->path = strdup(path);
+            t->dir = i;
+            t->hits = 0;
+
+            unsigned int h = hash(name);
+            t->next = ENTRIES[h];
+            ENTRIES[h] = t;
+            return t;
+        }
+    }
+
+    return NULL;
+}
+
+// finds the cached entry of a command, searching PATH on a miss
+static struct pathentry* resolve(char *name) {
+    refresh();
+
+    struct pathentry *t = ENTRIES[hash(name)];
+    while (t != NULL && strcmp(t->name, name) != 0) {
+        t = t->next;
+    }
+
+    return t != NULL ? t : search(name);
+}
+
+// path to run a command with, names with a "/" are used as they are,
+// returns NULL if the command is not found
+char* pathresolve(char *name) {
+    if (strchr(name, '/') != NULL)
+        return name;
+
+    struct pathentry *t = resolve(name);
+    if (t == NULL)
+        return NULL;
+
+    t->hits++;
+    return t->path;
+}
+
+// resolves a command into the cache without running it, -1 if not found
+int pathadd(char *name) {
+    if (strchr(name, '/') != NULL)
+        return 0;
+
+    return resolve(name) != NULL ? 0 : -1;
+}
+
+// drops a command from the cache, e.g. when its cached path went away
+void pathforget(char *name) {
+    struct pathentry **link = &ENTRIES[hash(name)];
+
+    while (*link != NULL) {
+        struct pathentry *t = *link;
+        if (strcmp(t->name, name) == 0) {
+            *link = t->next;
+            free(t->name);
+            free(t->path);
+            free(t);
+            return;
+        }
+        link = &t->next;
+    }
+}
+
+// drops every command from the cache
+void pathclear() {
+    drop(0);
+}
+
+// prints the cached commands and how often they were run to stdout
+void pathprint() {
+    int empty = 1;
+
+    for (int i = 0; i < PATH_BUCKETS; i++) {
+        for (struct pathentry *t = ENTRIES[i]; t != NULL; t = t->next) {
+            if (empty) {
+                printf("hits\tcommand\n");
+                empty = 0;
+            }
+            printf("%4d\t%s\n", t->hits, t->path);
+        }
+    }
+
+    if (empty) {
+        printf("hash: hash table empty\n");
+    }
+
+    // flush the buffer to stdout
+    fflush(stdout);
+}
+
+// deallocates the cache and the parsed PATH
+void pathfree() {
+    pathclear();
+
+    for (int i = 0; i < NDIRS; i++) {
+        free(DIRS[i].dir);
+    }
+    free(DIRS);
+    free(PATH);
+
+    DIRS = NULL;
+    NDIRS = 0;
+    PATH = NULL;
+}
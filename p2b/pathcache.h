@@ -0,0 +1,13 @@
+// Copyright [2022] <Devansh Goenka>
+
+#ifndef __PATHCACHE__
+#define __PATHCACHE__
+
+char* pathresolve(char *);
+int pathadd(char *);
+void pathforget(char *);
+void pathclear();
+void pathprint();
+void pathfree();
+
+#endif
@@ -0,0 +1,163 @@
+// Copyright [2022] <Devansh Goenka>
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+
+#include "profile.h"
+
+// Accounts the resources of commands for the "time" builtin and for
+// profiled batches (mysh -p). Profiled commands are summed up per command
+// line and written to stderr at exit, the slowest first.
+
+// number of buckets of the per command table
+#define PROFILE_BUCKETS 1024
+
+// the totals of every run of one command line
+struct profile {
+    struct profile *next;
+    char *command;
+    int calls;
+    struct usage total;
+};
+
+static struct profile *PROFILES[PROFILE_BUCKETS];
+static int NPROFILES = 0;
+static int ENABLED = 0;
+
+static double seconds(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// clears the usage and starts its wall clock
+void usage_start(struct usage *u) {
+    memset(u, 0, sizeof(*u));
+    clock_gettime(CLOCK_MONOTONIC, &u->start);
+}
+
+// adds the resources of a reaped process
+void usage_add(struct usage *u, struct rusage *ru) {
+    u->user += seconds(ru->ru_utime);
+    u->sys += seconds(ru->ru_stime);
+    if (ru->ru_maxrss > u->maxrss)
+        u->maxrss = ru->ru_maxrss;
+    u->nvcsw += ru->ru_nvcsw;
+    u->nivcsw += ru->ru_nivcsw;
+}
+
+// stops the wall clock once every process was reaped
+void usage_stop(struct usage *u) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    u->real = (now.tv_sec - u->start.tv_sec) +
+              (now.tv_nsec - u->start.tv_nsec) / 1e9;
+}
+
+// prints the usage of a timed command to stderr
+void usage_print(struct usage *u) {
+    char buffer[256];
+    size_t length = snprintf(buffer, sizeof(buffer),
+        "\nreal\t%dm%.3fs\nuser\t%dm%.3fs\nsys\t%dm%.3fs\nmaxrss\t%ldKB\ncsw\t%ld/%ld\n",
+        (int) (u->real / 60), u->real - (int) (u->real / 60) * 60,
+        (int) (u->user / 60), u->user - (int) (u->user / 60) * 60,
+        (int) (u->sys / 60), u->sys - (int) (u->sys / 60) * 60,
+        u->maxrss, u->nvcsw, u->nivcsw);
+    write(STDERR_FILENO, buffer, length);
+}
+
+void profile_enable() {
+    ENABLED = 1;
+}
+
+int profile_enabled() {
+    return ENABLED;
+}
+
+// FNV-1a hash of a command line
+static unsigned int hash(const char *command, size_t length) {
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        h ^= (unsigned char) command[i];
+        h *= 16777619u;
+    }
+    return h % PROFILE_BUCKETS;
+}
+
+// adds a finished command to the totals of its command line
+void profile_add(const char *command, struct usage *u) {
+    // parallel slots keep the line with its newline
+    size_t length = strcspn(command, "\n");
+    unsigned int h = hash(command, length);
+
+    struct profile *p = PROFILES[h];
+    while (p != NULL && (strncmp(p->command, command, length) != 0 ||
+                         p->command[length] != '\0')) {
+        p = p->next;
+    }
+
+    if (p == NULL) {
+        p = (struct profile *) calloc(1, sizeof(struct profile));
+        if (p == NULL)
+            return;
+
+        p->command = strndup(command, length);
+        p->next = PROFILES[h];
+        PROFILES[h] = p;
+        NPROFILES++;
+    }
+
+    p->calls++;
+    p->total.real += u->real;
+    p->total.user += u->user;
+    p->total.sys += u->sys;
+    if (u->maxrss > p->total.maxrss)
+        p->total.maxrss = u->maxrss;
+    p->total.nvcsw += u->nvcsw;
+    p->total.nivcsw += u->nivcsw;
+}
+
+// slowest command lines first
+static int compare(const void *a, const void *b) {
+    const struct profile *x = *(const struct profile **) a;
+    const struct profile *y = *(const struct profile **) b;
+
+    if (x->total.real != y->total.real)
+        return x->total.real < y->total.real ? 1 : -1;
+    return strcmp(x->command, y->command);
+}
+
+// writes the totals of every command line to stderr and frees them
+void profile_print() {
+    if (!ENABLED)
+        return;
+
+    struct profile **sorted = (struct profile **) malloc((NPROFILES + 1) * sizeof(struct profile *));
+    if (sorted == NULL)
+        return;
+
+    int n = 0;
+    for (int i = 0; i < PROFILE_BUCKETS; i++) {
+        for (struct profile *p = PROFILES[i]; p != NULL; p = p->next) {
+            sorted[n++] = p;
+        }
+    }
+    qsort(sorted, n, sizeof(struct profile *), compare);
+
+    FILE *out = stderr;
+    fprintf(out, "%6s %10s %10s %10s %10s %10s  %s\n",
+            "calls", "real", "user", "sys", "maxrss", "csw", "command");
+    for (int i = 0; i < n; i++) {
+        struct profile *p = sorted[i];
+        fprintf(out, "%6d %10.3f %10.3f %10.3f %8ldKB %10ld  %s\n",
+                p->calls, p->total.real, p->total.user, p->total.sys,
+                p->total.maxrss, p->total.nvcsw + p->total.nivcsw, p->command);
+        free(p->command);
+        free(p);
+    }
+    fflush(out);
+
+    free(sorted);
+    memset(PROFILES, 0, sizeof(PROFILES));
+    NPROFILES = 0;
+}
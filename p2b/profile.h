@@ -0,0 +1,30 @@
+// Copyright [2022] <Devansh Goenka>
+
+#ifndef __PROFILE__
+#define __PROFILE__
+
+#include<time.h>
+#include<sys/resource.h>
+
+// resources used by the processes of one command
+struct usage {
+    struct timespec start;
+    double real;        // seconds
+    double user;
+    double sys;
+    long maxrss;        // KB, the largest of any process
+    long nvcsw;         // voluntary context switches
+    long nivcsw;        // involuntary context switches
+};
+
+void usage_start(struct usage *);
+void usage_add(struct usage *, struct rusage *);
+void usage_stop(struct usage *);
+void usage_print(struct usage *);
+
+void profile_enable();
+int profile_enabled();
+void profile_add(const char *, struct usage *);
+void profile_print();
+
+#endif
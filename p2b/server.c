@@ -0,0 +1,163 @@
+// Copyright [2022] <Devansh Goenka>
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<signal.h>
+#include<errno.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<sys/socket.h>
+#include<sys/stat.h>
+#include<sys/un.h>
+
+#include "server.h"
+
+// Serves script lines sent to a Unix socket (mysh -s). Every connection is
+// answered by a worker forked off the server, so it starts out with the
+// server's aliases and cached paths and runs alongside other connections.
+// A worker answers every line, in order, with a header and what the line
+// wrote to stdout and stderr:
+//
+//     <status> <length>\n<length bytes of output>
+//
+// where status is the exit status of the last stage, 128 + the signal if it
+// was killed, 127 if it could not be started and 1 for a shell error.
+
+// connections waiting to be accepted
+#define BACKLOG 64
+
+// listens on a Unix socket at path, returns the socket or -1
+int server_listen(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    // a socket left behind by an earlier server is replaced, nothing else
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        listen(fd, BACKLOG) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// accepts connections forever, forking a worker for each one, returns the
+// connection in the worker, with stdout and stderr going to a capture file
+int server_accept(int listener) {
+    // workers are never waited for
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sa.sa_flags = SA_NOCLDWAIT;
+    sigaction(SIGCHLD, &sa, NULL);
+
+    // a client that hangs up only ends its worker, in write()
+    signal(SIGPIPE, SIG_IGN);
+
+    while (1) {
+        int conn = accept(listener, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            exit(1);
+        }
+
+        // commands never get the connection, only their output is sent
+        fcntl(conn, F_SETFD, FD_CLOEXEC);
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(listener);
+
+            // the worker waits for its own commands, which start with the
+            // usual signal handling
+            sa.sa_flags = 0;
+            sigaction(SIGCHLD, &sa, NULL);
+            signal(SIGPIPE, SIG_DFL);
+
+            // an unlinked temp file collects the output of every line
+            char name[] = "/tmp/mysh-XXXXXX";
+            int capture = mkstemp(name);
+            if (capture < 0) {
+                exit(1);
+            }
+            unlink(name);
+
+            fflush(stdout);
+            dup2(capture, STDOUT_FILENO);
+            dup2(capture, STDERR_FILENO);
+            close(capture);
+            return conn;
+        }
+
+        close(conn);
+    }
+}
+
+// writes all of buf to fd
+static int writeall(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// answers a line with its status and the output captured since the last
+// answer, then empties the capture file
+void server_reply(int conn, int status) {
+    fflush(stdout);
+    fflush(stderr);
+
+    off_t size = lseek(STDOUT_FILENO, 0, SEEK_END);
+    if (size < 0) {
+        size = 0;
+    }
+
+    char header[64];
+    size_t length = snprintf(header, sizeof(header), "%d %lld\n", status, (long long) size);
+    if (writeall(conn, header, length) < 0) {
+        exit(1);
+    }
+
+    char buffer[8192];
+    off_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(STDOUT_FILENO, buffer, sizeof(buffer), done);
+        if (n <= 0) {
+            break;
+        }
+        if (writeall(conn, buffer, n) < 0) {
+            exit(1);
+        }
+        done += n;
+    }
+
+    ftruncate(STDOUT_FILENO, 0);
+    lseek(STDOUT_FILENO, 0, SEEK_SET);
+}
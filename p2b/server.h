@@ -0,0 +1,10 @@
+// Copyright [2022] <Devansh Goenka>
+
+#ifndef __SERVER__
+#define __SERVER__
+
+int server_listen(const char*);
+int server_accept(int);
+void server_reply(int, int);
+
+#endif
@@ -4,7 +4,8 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint lastuse; // ticks when last released, for LRU recycling
+  struct buf *prev; // hash bucket list
   struct buf *next;
   struct buf *qnext; // disk queue
   uchar data[BSIZE];
@@ -71,6 +71,7 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kmemdump(void);
 
 // kbd.c
 void            kbdintr(void);
@@ -12,7 +12,7 @@
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUF         (MAXOPBLOCKS*30) // size of disk block cache
 #define FSSIZE       1000  // size of file system in blocks
 #define CLOCKSIZE    8   // CLOCKSIZE represents N above
 
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "archive.h"
+
+/* Streams recovered files into one ustar archive.
+ *
+ * Everything goes through a large buffer so the output file system sees a
+ * few big sequential writes instead of an open/write/close per file. Named
+ * copies become hard link members, and a text index member at the end lists
+ * where each file's data starts:
+ *
+ *   F <tab> data offset <tab> size <tab> name
+ *   L <tab> target <tab> name
+ */
+
+#define TAR_BLOCK 512
+
+struct tar_header {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char pad[12];
+};
+
+struct archive {
+	int fd;
+	char *buf;
+	size_t buf_len;
+	unsigned long long flushed;	/* bytes already handed to the file */
+	unsigned long long member_off;	/* where the current member starts, long name included */
+	unsigned long long header_off;	/* header of the current member */
+	unsigned long long data_off;	/* data of the current member */
+	unsigned long long declared;	/* size announced by archive_begin */
+	struct tar_header header;	/* header of the current member, patched on archive_end */
+	const char *name;		/* name of the current member */
+	char *index;
+	size_t index_len;
+	size_t index_cap;
+	int error;
+};
+
+static void flush(struct archive *ar)
+{
+	size_t done = 0;
+	while (done < ar->buf_len) {
+		ssize_t n = write(ar->fd, ar->buf + done, ar->buf_len - done);
+		if (n <= 0) {
+			ar->error = 1;
+			break;
+		}
+		done += n;
+	}
+	ar->flushed += ar->buf_len;
+	ar->buf_len = 0;
+}
+
+static void emit(struct archive *ar, const void *data, size_t len)
+{
+	if (ar->buf_len + len > ARCHIVE_BUFFER)
+		flush(ar);
+
+	// Anything as big as the buffer goes straight through
+	if (len >= ARCHIVE_BUFFER) {
+		if (write(ar->fd, data, len) != (ssize_t)len)
+			ar->error = 1;
+		ar->flushed += len;
+		return;
+	}
+
+	memcpy(ar->buf + ar->buf_len, data, len);
+	ar->buf_len += len;
+}
+
+static unsigned long long position(const struct archive *ar)
+{
+	return ar->flushed + ar->buf_len;
+}
+
+static void pad(struct archive *ar)
+{
+	static const char zeros[TAR_BLOCK];
+	unsigned long long rem = position(ar) % TAR_BLOCK;
+	if (rem)
+		emit(ar, zeros, TAR_BLOCK - rem);
+}
+
+static void checksum(struct tar_header *h)
+{
+	unsigned int sum = 0;
+	memset(h->chksum, ' ', sizeof(h->chksum));
+	for (size_t i = 0; i < sizeof(*h); i++)
+		sum += ((unsigned char *) h)[i];
+	snprintf(h->chksum, sizeof(h->chksum), "%06o", sum);
+	h->chksum[7] = ' ';
+}
+
+static void fill_header(struct tar_header *h, const char *name, char type, unsigned long long size,
+						unsigned int mtime, const char *linkname)
+{
+	memset(h, 0, sizeof(*h));
+	strncpy(h->name, name, sizeof(h->name));
+	snprintf(h->mode, sizeof(h->mode), "%07o", 0644);
+	snprintf(h->uid, sizeof(h->uid), "%07o", 0);
+	snprintf(h->gid, sizeof(h->gid), "%07o", 0);
+	snprintf(h->size, sizeof(h->size), "%011llo", size);
+	snprintf(h->mtime, sizeof(h->mtime), "%011o", mtime);
+	h->typeflag = type;
+	if (linkname)
+		strncpy(h->linkname, linkname, sizeof(h->linkname));
+	memcpy(h->magic, "ustar", 6);
+	memcpy(h->version, "00", 2);
+	checksum(h);
+}
+
+/* write a header, preceded by a GNU long name member when the name does not fit */
+static void emit_header(struct archive *ar, struct tar_header *h, const char *name)
+{
+	size_t len = strlen(name);
+
+	if (len >= sizeof(h->name)) {
+		struct tar_header longname;
+		fill_header(&longname, "././@LongLink", 'L', len + 1, 0, NULL);
+		emit(ar, &longname, sizeof(longname));
+		emit(ar, name, len + 1);
+		pad(ar);
+	}
+
+	ar->header_off = position(ar);
+	emit(ar, h, sizeof(*h));
+}
+
+/* rewrite a header that may already have left the buffer */
+static void patch(struct archive *ar, unsigned long long off, const void *data, size_t len)
+{
+	if (off >= ar->flushed)
+		memcpy(ar->buf + (off - ar->flushed), data, len);
+	else if (pwrite(ar->fd, data, len, off) != (ssize_t)len)
+		ar->error = 1;
+}
+
+static void add_index(struct archive *ar, const char *fmt, ...)
+{
+	char line[64 + 2 * 4096];
+	va_list ap;
+
+	va_start(ap, fmt);
+	int len = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+	if (len < 0 || len >= (int)sizeof(line))
+		return;
+
+	if (ar->index_len + len > ar->index_cap) {
+		while (ar->index_len + len > ar->index_cap)
+			ar->index_cap = ar->index_cap ? ar->index_cap * 2 : 4096;
+		ar->index = realloc(ar->index, ar->index_cap);
+		if (ar->index == NULL) {
+			ar->error = 1;
+			ar->index_len = ar->index_cap = 0;
+			return;
+		}
+	}
+
+	memcpy(ar->index + ar->index_len, line, len);
+	ar->index_len += len;
+}
+
+/* create a tar archive to stream recovered files into */
+struct archive *archive_open(const char *path)
+{
+	struct archive *ar = calloc(1, sizeof(struct archive));
+	if (ar == NULL)
+		return NULL;
+
+	ar->fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0666);
+	ar->buf = malloc(ARCHIVE_BUFFER);
+	if (ar->fd < 0 || ar->buf == NULL) {
+		if (ar->fd >= 0)
+			close(ar->fd);
+		free(ar->buf);
+		free(ar);
+		return NULL;
+	}
+
+	return ar;
+}
+
+/* start a member of the given size */
+int archive_begin(struct archive *ar, const char *name, unsigned long long size, unsigned int mtime)
+{
+	ar->member_off = position(ar);
+	fill_header(&ar->header, name, '0', size, mtime, NULL);
+	emit_header(ar, &ar->header, name);
+
+	ar->data_off = position(ar);
+	ar->declared = size;
+	ar->name = name;
+	return ar->error ? -1 : 0;
+}
+
+/* append data to the current member */
+void archive_write(struct archive *ar, const void *buf, size_t len)
+{
+	emit(ar, buf, len);
+}
+
+/* give access to the data of the current member */
+const unsigned char *archive_member(struct archive *ar, size_t *len, unsigned char **tmp)
+{
+	*len = position(ar) - ar->data_off;
+	*tmp = NULL;
+
+	if (ar->data_off >= ar->flushed)
+		return (unsigned char *) ar->buf + (ar->data_off - ar->flushed);
+
+	// Part of it already went out, read it back
+	flush(ar);
+	*tmp = malloc(*len ? *len : 1);
+	if (*tmp == NULL || pread(ar->fd, *tmp, *len, ar->data_off) != (ssize_t)*len) {
+		free(*tmp);
+		*tmp = NULL;
+		return NULL;
+	}
+	return *tmp;
+}
+
+/* throw away everything from offset cut on, whether still buffered or already written */
+static void truncate_at(struct archive *ar, unsigned long long cut)
+{
+	if (cut >= ar->flushed) {
+		ar->buf_len = cut - ar->flushed;
+	} else {
+		flush(ar);
+		if (ftruncate(ar->fd, cut) < 0 || lseek(ar->fd, cut, SEEK_SET) < 0)
+			ar->error = 1;
+		ar->flushed = cut;
+	}
+}
+
+/* finish the current member */
+int archive_end(struct archive *ar, unsigned long long size)
+{
+	unsigned long long written = position(ar) - ar->data_off;
+
+	// Drop trailing bytes and fix up the size in the header
+	if (size < written) {
+		truncate_at(ar, ar->data_off + size);
+		written = size;
+	}
+
+	if (written != ar->declared) {
+		snprintf(ar->header.size, sizeof(ar->header.size), "%011llo", written);
+		checksum(&ar->header);
+		patch(ar, ar->header_off, &ar->header, sizeof(ar->header));
+	}
+
+	pad(ar);
+	add_index(ar, "F\t%llu\t%llu\t%s\n", ar->data_off, written, ar->name);
+	return ar->error ? -1 : 0;
+}
+
+/* drop the current member as if archive_begin had never been called */
+int archive_drop(struct archive *ar)
+{
+	truncate_at(ar, ar->member_off);
+	return ar->error ? -1 : 0;
+}
+
+/* add name as a hard link to an earlier member */
+int archive_link(struct archive *ar, const char *name, const char *target)
+{
+	struct tar_header h;
+	fill_header(&h, name, '1', 0, 0, target);
+	emit_header(ar, &h, name);
+	add_index(ar, "L\t%s\t%s\n", target, name);
+	return ar->error ? -1 : 0;
+}
+
+/* write the index and end-of-archive marker and close the file */
+int archive_close(struct archive *ar)
+{
+	static const char zeros[2 * TAR_BLOCK];
+
+	struct tar_header h;
+	fill_header(&h, ARCHIVE_INDEX, '0', ar->index_len, time(NULL), NULL);
+	emit_header(ar, &h, ARCHIVE_INDEX);
+	emit(ar, ar->index, ar->index_len);
+	pad(ar);
+
+	emit(ar, zeros, sizeof(zeros));
+	flush(ar);
+
+	int rc = ar->error ? -1 : 0;
+	if (close(ar->fd) < 0)
+		rc = -1;
+
+	free(ar->index);
+	free(ar->buf);
+	free(ar);
+	return rc;
+}
@@ -0,0 +1,49 @@
+#ifndef ARCHIVE
+#define ARCHIVE
+#include <stddef.h>
+
+#define ARCHIVE_BUFFER (8 << 20)           /* bytes gathered before each write */
+#define ARCHIVE_INDEX "runscan.index"      /* name of the index member at the end */
+
+struct archive;
+
+/* create a tar archive to stream recovered files into, NULL on failure */
+struct archive *archive_open( const char *path);
+
+/* start a member of the given size, the data follows through archive_write */
+int archive_begin( struct archive     *ar,
+				   const char         *name,       /* member name */
+				   unsigned long long  size,       /* bytes that will be written */
+				   unsigned int        mtime       /* modification time */
+				   );
+
+/* append data to the current member */
+void archive_write( struct archive *ar,
+					const void     *buf,
+					size_t          len
+					);
+
+/* give access to the data of the current member, *tmp is set if it had to be read back */
+const unsigned char *archive_member( struct archive  *ar,
+									 size_t          *len,
+									 unsigned char  **tmp
+									 );
+
+/* finish the current member, size may be smaller than announced to drop trailing bytes */
+int archive_end( struct archive     *ar,
+				 unsigned long long  size
+				 );
+
+/* drop the current member instead of finishing it, nothing of it stays in the archive */
+int archive_drop( struct archive *ar);
+
+/* add name as a hard link to an earlier member */
+int archive_link( struct archive *ar,
+				  const char     *name,
+				  const char     *target
+				  );
+
+/* write the index and end-of-archive marker and close the file */
+int archive_close( struct archive *ar);
+
+#endif
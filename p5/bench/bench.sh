@@ -0,0 +1,36 @@
+#!/bin/bash
+# Time runscan end to end and per phase on an image.
+#
+# usage: bench.sh image [runs] [runscan options...]
+#
+# Each run recovers into a fresh scratch directory. Per phase numbers come
+# from runscan -s; set DROP_CACHES=1 (as root) to start every run cold.
+
+if [ $# -lt 1 ]; then
+	echo "usage: bench.sh image [runs] [runscan options...]"
+	exit 1
+fi
+
+IMAGE=$1
+RUNS=${2:-3}
+shift $(( $# >= 2 ? 2 : 1 ))
+
+RUNSCAN=$(dirname "$0")/../runscan
+SCRATCH=$(mktemp -d)
+trap 'rm -rf "$SCRATCH"' EXIT
+
+echo "bench: $IMAGE ($(( $(stat -c %s "$IMAGE") / 1024 / 1024 ))MB), $RUNS runs, options: $*"
+
+for run in $(seq 1 $RUNS); do
+	rm -rf "$SCRATCH/out"
+	if [ "$DROP_CACHES" = 1 ]; then
+		sync && echo 3 > /proc/sys/vm/drop_caches
+	fi
+
+	start=$(date +%s%N)
+	"$RUNSCAN" -s "$@" "$IMAGE" "$SCRATCH/out" 2> "$SCRATCH/stats" >/dev/null
+	end=$(date +%s%N)
+
+	echo "run $run: $(( (end - start) / 1000000 )) ms wall"
+	sed 's/^/    /' "$SCRATCH/stats"
+done
@@ -0,0 +1,114 @@
+#!/bin/bash
+# Generate a synthetic ext2 image for benchmarking runscan.
+#
+# The image is filled with JPEG-looking files (a JFIF header followed by
+# random bytes) spread over directories of 100 files each, and a share of
+# them is deleted afterwards so runscan has to recover unlinked inodes and
+# carve names out of directory slack. Needs mke2fs and debugfs (e2fsprogs).
+
+usage() {
+	echo "usage: mkimage.sh -o image [-s size-MB] [-b block-size] [-g groups] [-n files]"
+	echo "                  [-m min-KB] [-M max-KB] [-d uniform|exp] [-r deleted-%] [-S seed] [-I inode-size]"
+	exit 1
+}
+
+IMAGE=
+SIZE_MB=64
+BLOCK_SIZE=1024
+NGROUPS=0
+NFILES=200
+MIN_KB=1
+MAX_KB=256
+DIST=uniform
+DELETED=10
+SEED=537
+INODE_SIZE=256
+
+while getopts "o:s:b:g:n:m:M:d:r:S:I:" opt; do
+	case $opt in
+		o) IMAGE=$OPTARG ;;
+		s) SIZE_MB=$OPTARG ;;
+		b) BLOCK_SIZE=$OPTARG ;;
+		g) NGROUPS=$OPTARG ;;
+		n) NFILES=$OPTARG ;;
+		m) MIN_KB=$OPTARG ;;
+		M) MAX_KB=$OPTARG ;;
+		d) DIST=$OPTARG ;;
+		r) DELETED=$OPTARG ;;
+		S) SEED=$OPTARG ;;
+		I) INODE_SIZE=$OPTARG ;;
+		*) usage ;;
+	esac
+done
+
+[ -n "$IMAGE" ] || usage
+
+case $BLOCK_SIZE in
+	1024|2048|4096) ;;
+	*) echo "mkimage: block size must be 1024, 2048 or 4096"; exit 1 ;;
+esac
+
+case $DIST in
+	uniform|exp) ;;
+	*) echo "mkimage: distribution must be uniform or exp"; exit 1 ;;
+esac
+
+for tool in mke2fs debugfs; do
+	if ! command -v $tool >/dev/null && [ ! -x /sbin/$tool ] && [ ! -x /usr/sbin/$tool ]; then
+		echo "mkimage: $tool not found, install e2fsprogs"
+		exit 1
+	fi
+done
+export PATH=$PATH:/sbin:/usr/sbin
+
+# Spread the blocks evenly over the requested number of groups
+GROUP_ARGS=
+if [ "$NGROUPS" -gt 0 ]; then
+	BLOCKS=$(( SIZE_MB * 1024 * 1024 / BLOCK_SIZE ))
+	PER_GROUP=$(( (BLOCKS + NGROUPS - 1) / NGROUPS ))
+	PER_GROUP=$(( (PER_GROUP + 7) / 8 * 8 ))
+	if [ $PER_GROUP -gt $(( BLOCK_SIZE * 8 )) ] || [ $PER_GROUP -lt 256 ]; then
+		echo "mkimage: $NGROUPS groups need $PER_GROUP blocks per group, must be 256..$(( BLOCK_SIZE * 8 ))"
+		exit 1
+	fi
+	GROUP_ARGS="-g $PER_GROUP"
+fi
+
+ROOT=$(mktemp -d)
+trap 'rm -rf "$ROOT"' EXIT
+
+# One line per file: path, size in bytes, 1 if it gets deleted
+awk -v n=$NFILES -v min=$MIN_KB -v max=$MAX_KB -v dist=$DIST -v del=$DELETED -v seed=$SEED 'BEGIN {
+	srand(seed)
+	for (i = 0; i < n; i++) {
+		if (dist == "exp") {
+			kb = min - log(1 - rand()) * (max - min) / 4
+			if (kb > max) kb = max
+		} else {
+			kb = min + rand() * (max - min)
+		}
+		printf "dir-%d/image-%d.jpg %d %d\n", int(i / 100), i, int(kb * 1024) + 4, rand() * 100 < del
+	}
+}' > "$ROOT.list"
+
+mkdir "$ROOT/fs"
+while read -r path size deleted; do
+	mkdir -p "$ROOT/fs/$(dirname "$path")"
+	{ printf '\xff\xd8\xff\xe0'; head -c $(( size - 4 )) /dev/urandom; } > "$ROOT/fs/$path"
+done < "$ROOT.list"
+
+rm -f "$IMAGE"
+if ! mke2fs -q -F -t ext2 -I $INODE_SIZE -b $BLOCK_SIZE $GROUP_ARGS -d "$ROOT/fs" "$IMAGE" ${SIZE_MB}M 2>/dev/null; then
+	echo "mkimage: mke2fs failed, is the image large enough for the files?"
+	rm -f "$ROOT.list"
+	exit 1
+fi
+
+# Unlink the deleted share, leaving inodes and directory slack behind
+awk '$3 == 1 { print "rm /" $1 }' "$ROOT.list" > "$ROOT.cmds"
+if [ -s "$ROOT.cmds" ]; then
+	debugfs -w -f "$ROOT.cmds" "$IMAGE" >/dev/null 2>&1
+fi
+
+echo "mkimage: $IMAGE ${SIZE_MB}MB, $BLOCK_SIZE byte blocks, $NFILES files ($DIST $MIN_KB-${MAX_KB}KB), $(wc -l < "$ROOT.cmds") deleted"
+rm -f "$ROOT.list" "$ROOT.cmds"
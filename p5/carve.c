@@ -0,0 +1,163 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include "carve.h"
+
+/* Signature based file carving.
+ *
+ * Every known leading signature is compiled into a bit-parallel matcher:
+ * sig_table[k][c] has bit s set when signature s accepts byte c at offset k
+ * (or is shorter than k). ANDing the rows for the first CARVE_MAX_MAGIC bytes
+ * of a block leaves exactly the signatures that match, so one pass over eight
+ * bytes tests them all no matter how many types are enabled.
+ */
+
+enum { JPEG, PNG, GIF, PDF, ZIP, ELF, GZIP, BZIP2, TIFF, MP3 };
+
+const struct carve_type carve_types[] = {
+	[JPEG]  = { "jpeg",  "jpg", (const unsigned char *) "\xff\xd9", 2, 0 },
+	[PNG]   = { "png",   "png", (const unsigned char *) "IEND\xae\x42\x60\x82", 8, 0 },
+	[GIF]   = { "gif",   "gif", (const unsigned char *) "\x00\x3b", 2, 0 },
+	[PDF]   = { "pdf",   "pdf", (const unsigned char *) "%%EOF", 5, 0 },
+	/* end of central directory record, assumes an empty archive comment */
+	[ZIP]   = { "zip",   "zip", (const unsigned char *) "PK\x05\x06", 4, 18 },
+	[ELF]   = { "elf",   "elf", NULL, 0, 0 },
+	[GZIP]  = { "gzip",  "gz",  NULL, 0, 0 },
+	[BZIP2] = { "bzip2", "bz2", NULL, 0, 0 },
+	[TIFF]  = { "tiff",  "tif", NULL, 0, 0 },
+	[MP3]   = { "mp3",   "mp3", NULL, 0, 0 },
+};
+
+const int carve_ntypes = sizeof(carve_types) / sizeof(carve_types[0]);
+
+/* a leading signature, several may map to the same type */
+struct carve_sig {
+	int                  type;
+	const unsigned char *magic;
+	int                  len;
+};
+
+#define SIG(type, magic) { type, (const unsigned char *) magic, sizeof(magic) - 1 }
+
+static const struct carve_sig carve_sigs[] = {
+	SIG(JPEG,  "\xff\xd8\xff\xe0"),
+	SIG(JPEG,  "\xff\xd8\xff\xe1"),
+	SIG(JPEG,  "\xff\xd8\xff\xe8"),
+	SIG(PNG,   "\x89PNG\r\n\x1a\n"),
+	SIG(GIF,   "GIF87a"),
+	SIG(GIF,   "GIF89a"),
+	SIG(PDF,   "%PDF-"),
+	SIG(ZIP,   "PK\x03\x04"),
+	SIG(ELF,   "\x7f" "ELF"),
+	SIG(GZIP,  "\x1f\x8b\x08"),
+	SIG(BZIP2, "BZh"),
+	SIG(TIFF,  "II*\x00"),
+	SIG(TIFF,  "MM\x00*"),
+	SIG(MP3,   "ID3"),
+};
+
+#define NSIGS (int)(sizeof(carve_sigs) / sizeof(carve_sigs[0]))
+
+static unsigned int sig_table[CARVE_MAX_MAGIC][256];   /* signatures accepting byte c at offset k */
+static unsigned int sig_fits[CARVE_MAX_MAGIC + 1];     /* signatures no longer than k bytes */
+
+/* build the matcher tables for the types enabled in the mask */
+void carve_init(unsigned int type_mask)
+{
+	memset(sig_table, 0, sizeof(sig_table));
+	memset(sig_fits, 0, sizeof(sig_fits));
+
+	for (int s = 0; s < NSIGS; s++) {
+		const struct carve_sig *sig = &carve_sigs[s];
+
+		if (!(type_mask & (1u << sig->type)))
+			continue;
+
+		for (int k = 0; k < CARVE_MAX_MAGIC; k++) {
+			// Past the end of the signature any byte is fine
+			if (k >= sig->len) {
+				for (int c = 0; c < 256; c++)
+					sig_table[k][c] |= 1u << s;
+			} else {
+				sig_table[k][sig->magic[k]] |= 1u << s;
+			}
+		}
+
+		for (int k = sig->len; k <= CARVE_MAX_MAGIC; k++)
+			sig_fits[k] |= 1u << s;
+	}
+}
+
+/* look up a type by name */
+int carve_lookup(const char *name)
+{
+	for (int i = 0; i < carve_ntypes; i++)
+		if (strcmp(carve_types[i].name, name) == 0)
+			return i;
+	return -1;
+}
+
+/* match every enabled signature against the start of buf in one pass */
+int carve_match(const unsigned char *buf, size_t len)
+{
+	int n = len < CARVE_MAX_MAGIC ? (int)len : CARVE_MAX_MAGIC;
+	unsigned int mask = sig_fits[n];
+
+	// Short buffers can only hold the signatures that fit in them
+	if (n == CARVE_MAX_MAGIC)
+		mask = ~0u;
+
+	for (int k = 0; k < n && mask; k++)
+		mask &= sig_table[k][buf[k]];
+
+	if (!mask)
+		return -1;
+
+	// Prefer the longest, most specific signature
+	int best = -1;
+	for (int s = 0; s < NSIGS; s++)
+		if ((mask & (1u << s)) && (best < 0 || carve_sigs[s].len > carve_sigs[best].len))
+			best = s;
+
+	return carve_sigs[best].type;
+}
+
+/* feed the next chunk of a file to the end-of-file marker detector */
+void carve_scan_end(int type, struct carve_end *state, const unsigned char *buf, size_t len)
+{
+	const struct carve_type *t = &carve_types[type];
+
+	if (t->eof == NULL || len == 0)
+		return;
+
+	// Markers straddling the previous chunk and this one
+	unsigned char join[2 * CARVE_MAX_EOF];
+	size_t head = len < (size_t)t->eof_len - 1 ? len : (size_t)t->eof_len - 1;
+	memcpy(join, state->tail, state->tail_len);
+	memcpy(join + state->tail_len, buf, head);
+
+	for (int i = 0; i < state->tail_len; i++)
+		if (i + t->eof_len <= state->tail_len + (int)head &&
+			memcmp(join + i, t->eof, t->eof_len) == 0)
+			state->end = state->pos - state->tail_len + i + t->eof_len + t->eof_extra;
+
+	// Markers inside this chunk, the last one wins
+	const unsigned char *p = buf;
+	const unsigned char *hit;
+	while ((hit = memmem(p, len - (p - buf), t->eof, t->eof_len)) != NULL) {
+		state->end = state->pos + (hit - buf) + t->eof_len + t->eof_extra;
+		p = hit + 1;
+	}
+
+	// Keep the last few bytes around for the next chunk
+	int keep = t->eof_len - 1;
+	if ((int)len >= keep) {
+		memcpy(state->tail, buf + len - keep, keep);
+	} else {
+		int old = state->tail_len + (int)len > keep ? keep - (int)len : state->tail_len;
+		memmove(state->tail, state->tail + state->tail_len - old, old);
+		memcpy(state->tail + old, buf, len);
+		keep = old + (int)len;
+	}
+	state->tail_len = keep;
+	state->pos += len;
+}
@@ -0,0 +1,40 @@
+#ifndef CARVE
+#define CARVE
+#include <stddef.h>
+
+#define CARVE_MAX_MAGIC 8                  /* longest leading signature we match */
+#define CARVE_MAX_EOF   8                  /* longest end-of-file marker */
+
+/* a kind of file the carving engine knows how to recognise */
+struct carve_type {
+	const char          *name;             /* short name used on the command line */
+	const char          *ext;              /* extension given to recovered files */
+	const unsigned char *eof;              /* end-of-file marker, NULL if the format has none */
+	int                  eof_len;          /* length of the marker */
+	int                  eof_extra;        /* bytes of trailer that follow the marker */
+};
+
+/* tracks the last end-of-file marker seen while a file streams through */
+struct carve_end {
+	unsigned long long   pos;              /* bytes fed so far */
+	unsigned long long   end;              /* offset just past the last marker, 0 if none */
+	unsigned char        tail[CARVE_MAX_EOF]; /* last bytes of the previous chunk */
+	int                  tail_len;
+};
+
+extern const struct carve_type carve_types[];
+extern const int carve_ntypes;
+
+/* build the matcher tables for the types enabled in the mask (bit i = carve_types[i]) */
+void carve_init(unsigned int type_mask);
+
+/* look up a type by name, returns its index or -1 */
+int carve_lookup(const char *name);
+
+/* match every enabled signature against the start of buf in one pass, returns a type index or -1 */
+int carve_match(const unsigned char *buf, size_t len);
+
+/* feed the next chunk of a file of the given type to the end-of-file marker detector */
+void carve_scan_end(int type, struct carve_end *state, const unsigned char *buf, size_t len);
+
+#endif
@@ -42,6 +42,14 @@ typedef __int16_t	__s16;
 /* First non-reserved inode for old ext2 filesystems */
 #define EXT2_GOOD_OLD_FIRST_INO	11
 
+/* Revision levels, inode size is fixed before EXT2_DYNAMIC_REV */
+#define EXT2_GOOD_OLD_REV	0	/* The good old (original) format */
+#define EXT2_DYNAMIC_REV	1 	/* V2 format w/ dynamic inode sizes */
+#define EXT2_GOOD_OLD_INODE_SIZE 128
+
+/* Read-only compatible features */
+#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER	0x0001
+
 /*
  * The second extended file system magic number
  */
@@ -179,6 +187,16 @@ struct ext2_dir_entry_2 {
 };
 #define EXT2_NAME_LEN 255
 
+/*
+ * EXT2_DIR_PAD defines the directory entries boundaries
+ *
+ * NOTE: It must be a multiple of 4
+ */
+#define EXT2_DIR_PAD		 	4
+#define EXT2_DIR_ROUND 			(EXT2_DIR_PAD - 1)
+#define EXT2_DIR_REC_LEN(name_len)	(((name_len) + 8 + EXT2_DIR_ROUND) & \
+					 ~EXT2_DIR_ROUND)
+
 
 // Old structure of a directory entry; deperciated
 struct ext2_dir_entry {
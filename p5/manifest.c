@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "manifest.h"
+#include "carve.h"
+
+/* Incremental rescans.
+ *
+ * The manifest records, for every file a run recovered, the inode's
+ * generation, size and a hash of its block map. A later run with the same
+ * manifest reuses the earlier copy of any inode whose record still matches,
+ * so only new or changed files have their data read again. The names
+ * linked to the copies are kept too, so a rescan can drop the ones whose
+ * directory entries went away. The file is plain text:
+ *
+ *   runscan-manifest <version> <inodes> <options>
+ *   f <inode> <generation> <size> <hash> <type>
+ *   n <name>
+ */
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+static unsigned long long fnv(unsigned long long hash, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	for (size_t i = 0; i < len; i++)
+		hash = (hash ^ p[i]) * FNV_PRIME;
+	return hash;
+}
+
+static int hash_block(unsigned long long lblock, unsigned int pblock, void *arg)
+{
+	(void) lblock;
+	*(unsigned long long *) arg = fnv(*(unsigned long long *) arg, &pblock, sizeof(pblock));
+	return 0;
+}
+
+/* hash the block map and timestamps of an inode */
+unsigned long long block_map_hash(const struct ext2_image *img, const struct ext2_inode *inode)
+{
+	unsigned long long hash = FNV_OFFSET;
+
+	// Rewrites in place keep the block map, the timestamps still move
+	hash = fnv(hash, &inode->i_mtime, sizeof(inode->i_mtime));
+	hash = fnv(hash, &inode->i_ctime, sizeof(inode->i_ctime));
+	hash = fnv(hash, inode->i_block, sizeof(inode->i_block));
+
+	if (iterate_inode_blocks(img, inode, hash_block, &hash) != 0)
+		return 0;
+	return hash;
+}
+
+/* an empty manifest for an image with ninodes inodes */
+struct manifest *manifest_new(unsigned int ninodes, unsigned int options)
+{
+	struct manifest *manifest = malloc(sizeof(struct manifest));
+	if (manifest == NULL)
+		return NULL;
+
+	manifest->ninodes = ninodes;
+	manifest->options = options;
+	manifest->loaded = 0;
+	manifest->names = NULL;
+	manifest->names_len = manifest->names_cap = 0;
+	manifest->entries = calloc((size_t)ninodes + 1, sizeof(struct manifest_entry));
+	if (manifest->entries == NULL) {
+		free(manifest);
+		return NULL;
+	}
+
+	return manifest;
+}
+
+/* load a manifest written by an earlier run */
+struct manifest *manifest_load(const char *path, unsigned int ninodes, unsigned int options)
+{
+	struct manifest *manifest = manifest_new(ninodes, options);
+	if (manifest == NULL)
+		return NULL;
+
+	FILE *in = fopen(path, "r");
+	if (in == NULL)
+		return manifest;
+
+	// A different image or different options make every record stale, the caller
+	// decides what to do with the outputs of that other run
+	unsigned int version, file_ninodes, file_options;
+	if (fscanf(in, "runscan-manifest %u %u %u\n", &version, &file_ninodes, &file_options) != 3 ||
+		version != MANIFEST_VERSION || file_ninodes != ninodes || file_options != options) {
+		if (debug)
+			printf("runScan: manifest %s does not match this run\n", path);
+		fclose(in);
+		return manifest;
+	}
+	manifest->loaded = 1;
+
+	char *line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+	while ((len = getline(&line, &cap, in)) > 0) {
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+
+		if (line[0] == 'n' && line[1] == ' ') {
+			if (manifest_add_name(manifest, line + 2) < 0)
+				break;
+			continue;
+		}
+
+		unsigned int ino, generation;
+		unsigned long long size, hash;
+		char type[16];
+		if (sscanf(line, "f %u %u %llu %llx %15s", &ino, &generation, &size, &hash, type) != 5)
+			continue;
+
+		int t = carve_lookup(type);
+		if (ino == 0 || ino > ninodes || t < 0)
+			continue;
+
+		struct manifest_entry *entry = &manifest->entries[ino];
+		entry->generation = generation;
+		entry->size = size;
+		entry->hash = hash;
+		entry->type = t + 1;
+	}
+
+	free(line);
+	fclose(in);
+	return manifest;
+}
+
+/* remember a name linked in the output directory */
+int manifest_add_name(struct manifest *manifest, const char *name)
+{
+	size_t len = strlen(name) + 1;
+
+	if (manifest->names_len + len > manifest->names_cap) {
+		size_t cap = manifest->names_cap ? manifest->names_cap : 4096;
+		while (manifest->names_len + len > cap)
+			cap *= 2;
+
+		char *names = realloc(manifest->names, cap);
+		if (names == NULL)
+			return -1;
+		manifest->names = names;
+		manifest->names_cap = cap;
+	}
+
+	memcpy(manifest->names + manifest->names_len, name, len);
+	manifest->names_len += len;
+	return 0;
+}
+
+/* write a manifest, replacing path atomically */
+int manifest_save(const struct manifest *manifest, const char *path)
+{
+	char tmp[strlen(path) + 5];
+	sprintf(tmp, "%s.tmp", path);
+
+	FILE *out = fopen(tmp, "w");
+	if (out == NULL)
+		return -1;
+
+	fprintf(out, "runscan-manifest %u %u %u\n", MANIFEST_VERSION, manifest->ninodes, manifest->options);
+
+	for (unsigned int ino = 1; ino <= manifest->ninodes; ino++) {
+		const struct manifest_entry *entry = &manifest->entries[ino];
+		if (entry->type == 0)
+			continue;
+		fprintf(out, "f %u %u %llu %llx %s\n", ino, entry->generation, entry->size, entry->hash,
+				carve_types[entry->type - 1].name);
+	}
+
+	// Names with a newline in them cannot be told apart from the next record
+	for (size_t off = 0; off < manifest->names_len; off += strlen(manifest->names + off) + 1)
+		if (strchr(manifest->names + off, '\n') == NULL)
+			fprintf(out, "n %s\n", manifest->names + off);
+
+	if (fclose(out) != 0 || rename(tmp, path) < 0) {
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+void manifest_free(struct manifest *manifest)
+{
+	if (manifest == NULL)
+		return;
+	free(manifest->entries);
+	free(manifest->names);
+	free(manifest);
+}
@@ -0,0 +1,54 @@
+#ifndef MANIFEST
+#define MANIFEST
+#include "read_ext2.h"
+
+#define MANIFEST_VERSION 1
+
+/* what an earlier run recovered from one inode */
+struct manifest_entry {
+	unsigned int generation;               /* i_version of the inode */
+	unsigned int type;                     /* carve type + 1, 0 when nothing was recovered */
+	unsigned long long size;               /* size of the inode, large files included */
+	unsigned long long hash;               /* block map hash of the inode */
+};
+
+/* per-inode record of a run, indexed by global inode number */
+struct manifest {
+	unsigned int ninodes;
+	unsigned int options;                  /* runscan options that change the recovered bytes */
+	int loaded;                            /* read from a file written for this image and options */
+	struct manifest_entry *entries;
+	char *names;                           /* NUL-separated names linked in the output directory */
+	size_t names_len;
+	size_t names_cap;
+};
+
+/* hash the block map and timestamps of an inode, reads only its indirect blocks */
+unsigned long long block_map_hash( const struct ext2_image *img,
+								   const struct ext2_inode *inode
+								   );
+
+/* an empty manifest for an image with ninodes inodes, NULL when out of memory */
+struct manifest *manifest_new( unsigned int ninodes,
+							   unsigned int options
+							   );
+
+/* load a manifest, empty and not loaded if the file is missing or was written for another image or options */
+struct manifest *manifest_load( const char   *path,
+								unsigned int  ninodes,
+								unsigned int  options
+								);
+
+/* remember a name linked in the output directory, -1 when out of memory */
+int manifest_add_name( struct manifest *manifest,
+					   const char      *name
+					   );
+
+/* write a manifest, replacing path atomically */
+int manifest_save( const struct manifest *manifest,
+				   const char            *path
+				   );
+
+void manifest_free( struct manifest *manifest);
+
+#endif
@@ -1,4 +1,12 @@
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#endif
 #include "read_ext2.h"
 
 /* implementations credit to
@@ -6,55 +14,8 @@
  * http://www.science.smith.edu/~nhowe/Teaching/csc262/oldlabs/ext2.html
  */
 
-unsigned int block_size = 1024;        					/* default 1kB block size */
-unsigned int inodes_per_block = 0;                      /* number of inodes per block */
-unsigned int itable_blocks = 0;                         /* size in blocks of the inode table */
-unsigned int blocks_per_group = 0;
-unsigned int num_groups = 0;
-unsigned int inodes_per_group = 0;
-
-
 int debug = 0;          //turn on/off debug prints
 
-/* read the first super block to initialize common variables */
-void ext2_read_init(int fd)
-{
-	struct ext2_super_block super;
-	lseek(fd, BASE_OFFSET, SEEK_SET);        						/* position head above super-block */
-    read(fd, &super, sizeof(struct ext2_super_block));              /* read super-block */
-
-    if (super.s_magic != EXT2_SUPER_MAGIC) {
-        fprintf(stderr, "read_super_block: Not a Ext2 filesystem\n");
-        exit(1);
-    }
-
-	block_size = 1024 << super.s_log_block_size;
-	inodes_per_block = block_size / sizeof(struct ext2_inode);		/* number of inodes per block */
-	itable_blocks = super.s_inodes_per_group / inodes_per_block;		/* size in blocks of the inode table */
-	blocks_per_group = super.s_blocks_per_group;
-	num_groups = (super.s_blocks_count + blocks_per_group - 1) / blocks_per_group;
-	inodes_per_group = super.s_inodes_per_group;
-
-		
-	if (debug)
-	{
-		printf("Reading first super-block from device: \n"
-				"Block size                    : %u\n"
-				"number of inodes in a block   : %u\n"
-				"Inode table size in blocks    : %u\n"
-				"Blocks per group              : %u\n"
-				"number of block groups        : %u\n"
-				,
-				block_size,
-				inodes_per_block,
-				itable_blocks,
-				blocks_per_group,
-				num_groups);
-	}
-		
-		
-}
-
 int isPowerOf(int m, int n) 
 {
     while (m != 1) 
@@ -83,39 +44,394 @@ int powersBelow(int m, int n)
     return cnt;
 }
 
+/* does the given block group hold a backup of the super block and descriptor table */
+int group_has_super(const struct ext2_image *img, int ngroup)
+{
+	// Without sparse_super every group carries a copy
+	if (!(img->super.s_feature_ro_compat & EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER))
+		return 1;
+
+	// Otherwise only groups 0, 1 and powers of 3, 5 and 7 do
+	return ngroup == 0 ||
+		   ngroup == 1 ||
+		   isPowerOf(ngroup, 3) ||
+		   isPowerOf(ngroup, 5) ||
+		   isPowerOf(ngroup, 7);
+}
+
+/* does a group-descriptor table point inside the file system everywhere */
+static int valid_group_table(const struct ext2_image *img, const struct ext2_group_desc *groups)
+{
+	for (unsigned int i = 0; i < img->num_groups; i++) {
+		if (groups[i].bg_inode_table == 0 ||
+			groups[i].bg_inode_table + img->itable_blocks > img->super.s_blocks_count ||
+			groups[i].bg_block_bitmap >= img->super.s_blocks_count ||
+			groups[i].bg_inode_bitmap >= img->super.s_blocks_count)
+			return 0;
+	}
+	return 1;
+}
+
+/* load the group-descriptor table, falling back to the backups when the primary is damaged */
+static int load_group_table(struct ext2_image *img)
+{
+	size_t len = img->num_groups * sizeof(struct ext2_group_desc);
+
+	img->groups = malloc(len);
+	if (img->groups == NULL)
+		return -1;
+
+	// The primary table follows the first super block, backups sit right after each super block copy
+	for (unsigned int ngroup = 0; ngroup < img->num_groups; ngroup++) {
+		if (!group_has_super(img, ngroup))
+			continue;
+
+		off_t offset = BLOCK_OFFSET(img, img->first_data_block + img->blocks_per_group * ngroup + 1);
+		if (pread(img->fd, img->groups, len, offset) == (ssize_t)len && valid_group_table(img, img->groups)) {
+			if (debug && ngroup != 0)
+				printf("load_group_table: primary table damaged, using backup in group %u\n", ngroup);
+			return 0;
+		}
+	}
+
+	free(img->groups);
+	img->groups = NULL;
+	return -1;
+}
+
+/* Block cache.
+ *
+ * Indirect blocks and the first block of every file are read more than
+ * once in a scan: by the type match, the manifest hash and the copy. The
+ * cache keeps the most recently used blocks of the image, split into shards
+ * by block number so each one can be locked on its own. On a miss the
+ * caller may ask for the blocks that follow to be read in the same pread.
+ */
+
+struct cache_entry {
+	unsigned int block;		/* block held, 0 when the entry is unused */
+	int prev, next;			/* LRU list, most recent at the head */
+	int chain;			/* next entry in the same hash bucket */
+};
+
+struct cache_shard {
+	pthread_mutex_t lock;
+	struct cache_entry *entries;
+	char *data;			/* capacity blocks, one per entry */
+	int *buckets;			/* first entry of every hash chain, -1 if empty */
+	unsigned int nbuckets;
+	unsigned int capacity;
+	unsigned int used;
+	int head, tail;
+	struct block_cache_stats stats;
+};
+
+struct block_cache {
+	unsigned int block_size;
+	struct cache_shard shards[BLOCK_CACHE_SHARDS];
+};
+
+static unsigned int cache_hash(unsigned int block)
+{
+	return block * 2654435761u;
+}
+
+static struct cache_shard *cache_shard(const struct block_cache *cache, unsigned int block)
+{
+	return (struct cache_shard *) &cache->shards[cache_hash(block) % BLOCK_CACHE_SHARDS];
+}
+
+static void lru_unlink(struct cache_shard *shard, int e)
+{
+	struct cache_entry *entry = &shard->entries[e];
+
+	if (entry->prev >= 0)
+		shard->entries[entry->prev].next = entry->next;
+	else
+		shard->head = entry->next;
+	if (entry->next >= 0)
+		shard->entries[entry->next].prev = entry->prev;
+	else
+		shard->tail = entry->prev;
+}
+
+static void lru_push(struct cache_shard *shard, int e)
+{
+	struct cache_entry *entry = &shard->entries[e];
+
+	entry->prev = -1;
+	entry->next = shard->head;
+	if (shard->head >= 0)
+		shard->entries[shard->head].prev = e;
+	shard->head = e;
+	if (shard->tail < 0)
+		shard->tail = e;
+}
+
+/* find a block in its shard, the shard lock must be held */
+static int cache_find(struct cache_shard *shard, unsigned int block)
+{
+	int e = shard->buckets[(cache_hash(block) / BLOCK_CACHE_SHARDS) % shard->nbuckets];
+	while (e >= 0 && shard->entries[e].block != block)
+		e = shard->entries[e].chain;
+	return e;
+}
+
+/* copy a block into the cache, evicting the least recently used one if full */
+static void cache_insert(struct block_cache *cache, unsigned int block, const char *buffer)
+{
+	struct cache_shard *shard = cache_shard(cache, block);
+	pthread_mutex_lock(&shard->lock);
+
+	int e = cache_find(shard, block);
+	if (e >= 0) {
+		lru_unlink(shard, e);
+	} else if (shard->used < shard->capacity) {
+		e = shard->used++;
+	} else {
+		// Take the tail entry off its hash chain
+		e = shard->tail;
+		lru_unlink(shard, e);
+		int *link = &shard->buckets[(cache_hash(shard->entries[e].block) / BLOCK_CACHE_SHARDS) % shard->nbuckets];
+		while (*link != e)
+			link = &shard->entries[*link].chain;
+		*link = shard->entries[e].chain;
+		shard->entries[e].block = 0;
+	}
+
+	if (shard->entries[e].block != block) {
+		int *bucket = &shard->buckets[(cache_hash(block) / BLOCK_CACHE_SHARDS) % shard->nbuckets];
+		shard->entries[e].block = block;
+		shard->entries[e].chain = *bucket;
+		*bucket = e;
+	}
+
+	memcpy(shard->data + (size_t)e * cache->block_size, buffer, cache->block_size);
+	lru_push(shard, e);
+
+	pthread_mutex_unlock(&shard->lock);
+}
+
+static struct block_cache *block_cache_create(unsigned int block_size)
+{
+	struct block_cache *cache = calloc(1, sizeof(struct block_cache));
+	if (cache == NULL)
+		return NULL;
+
+	cache->block_size = block_size;
+	unsigned int capacity = BLOCK_CACHE_SIZE / block_size / BLOCK_CACHE_SHARDS;
+
+	for (int i = 0; i < BLOCK_CACHE_SHARDS; i++) {
+		struct cache_shard *shard = &cache->shards[i];
+
+		pthread_mutex_init(&shard->lock, NULL);
+		shard->capacity = capacity;
+		shard->nbuckets = capacity * 2;
+		shard->head = shard->tail = -1;
+		shard->entries = calloc(capacity, sizeof(struct cache_entry));
+		shard->data = malloc((size_t)capacity * block_size);
+		shard->buckets = malloc(shard->nbuckets * sizeof(int));
+
+		if (shard->entries == NULL || shard->data == NULL || shard->buckets == NULL)
+			goto fail;
+		memset(shard->buckets, -1, shard->nbuckets * sizeof(int));
+	}
+
+	return cache;
+
+fail:
+	for (int i = 0; i < BLOCK_CACHE_SHARDS; i++) {
+		free(cache->shards[i].entries);
+		free(cache->shards[i].data);
+		free(cache->shards[i].buckets);
+	}
+	free(cache);
+	return NULL;
+}
+
+static void block_cache_free(struct block_cache *cache)
+{
+	if (cache == NULL)
+		return;
+
+	for (int i = 0; i < BLOCK_CACHE_SHARDS; i++) {
+		pthread_mutex_destroy(&cache->shards[i].lock);
+		free(cache->shards[i].entries);
+		free(cache->shards[i].data);
+		free(cache->shards[i].buckets);
+	}
+	free(cache);
+}
+
+/* copy a block out of the cache without going to the image */
+int block_cache_lookup(const struct ext2_image *img, unsigned int block, char *buffer)
+{
+	if (img->cache == NULL || block == 0)
+		return 0;
+
+	struct cache_shard *shard = cache_shard(img->cache, block);
+	pthread_mutex_lock(&shard->lock);
+
+	int e = cache_find(shard, block);
+	if (e >= 0) {
+		memcpy(buffer, shard->data + (size_t)e * img->block_size, img->block_size);
+		lru_unlink(shard, e);
+		lru_push(shard, e);
+		shard->stats.hits++;
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+	return e >= 0;
+}
+
+/* read one block through the block cache */
+int read_block(const struct ext2_image *img, unsigned int block, char *buffer, unsigned int ahead)
+{
+	if (block_cache_lookup(img, block, buffer))
+		return img->block_size;
+
+	if (img->cache == NULL || block == 0)
+		return read_data(img, block, buffer, img->block_size) == (int)img->block_size ? (int)img->block_size : -1;
+
+	// Never read past the end of the image
+	if (ahead > BLOCK_CACHE_AHEAD)
+		ahead = BLOCK_CACHE_AHEAD;
+	if (block + ahead >= img->super.s_blocks_count)
+		ahead = block < img->super.s_blocks_count ? img->super.s_blocks_count - block - 1 : 0;
+
+	char *run = buffer;
+	if (ahead > 0 && (run = malloc((size_t)(ahead + 1) * img->block_size)) == NULL) {
+		run = buffer;
+		ahead = 0;
+	}
+
+	ssize_t got = pread(img->fd, run, (size_t)(ahead + 1) * img->block_size, BLOCK_OFFSET(img, block));
+	unsigned int nread = got > 0 ? got / img->block_size : 0;
+
+	for (unsigned int i = 0; i < nread; i++)
+		cache_insert(img->cache, block + i, run + (size_t)i * img->block_size);
+
+	struct cache_shard *shard = cache_shard(img->cache, block);
+	pthread_mutex_lock(&shard->lock);
+	shard->stats.misses++;
+	shard->stats.ahead += nread > 1 ? nread - 1 : 0;
+	pthread_mutex_unlock(&shard->lock);
+
+	if (run != buffer) {
+		if (nread > 0)
+			memcpy(buffer, run, img->block_size);
+		free(run);
+	}
+
+	return nread > 0 ? (int)img->block_size : -1;
+}
+
+/* sum the counters of every cache shard */
+void block_cache_stats(const struct ext2_image *img, struct block_cache_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if (img->cache == NULL)
+		return;
+
+	for (int i = 0; i < BLOCK_CACHE_SHARDS; i++) {
+		struct cache_shard *shard = &img->cache->shards[i];
+		pthread_mutex_lock(&shard->lock);
+		stats->hits += shard->stats.hits;
+		stats->misses += shard->stats.misses;
+		stats->ahead += shard->stats.ahead;
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+/* read the first super block and the group-descriptor table */
+struct ext2_image *ext2_read_init(int fd)
+{
+	struct ext2_image *img = calloc(1, sizeof(struct ext2_image));
+	if (img == NULL)
+		return NULL;
+
+	img->fd = fd;
+	struct ext2_super_block *super = &img->super;
+	
+	if (pread(fd, super, sizeof(struct ext2_super_block), BASE_OFFSET) != sizeof(struct ext2_super_block) ||  /* read super-block */
+		super->s_magic != EXT2_SUPER_MAGIC) {
+        fprintf(stderr, "read_super_block: Not a Ext2 filesystem\n");
+		free(img);
+		return NULL;
+    }
+
+	img->block_size = 1024 << super->s_log_block_size;
+	img->inode_size = super->s_rev_level == EXT2_GOOD_OLD_REV ? EXT2_GOOD_OLD_INODE_SIZE : super->s_inode_size;
+	img->inodes_per_block = img->block_size / img->inode_size;		/* number of inodes per block */
+	img->itable_blocks = (super->s_inodes_per_group + img->inodes_per_block - 1) / img->inodes_per_block;		/* size in blocks of the inode table */
+	img->blocks_per_group = super->s_blocks_per_group;
+	img->inodes_per_group = super->s_inodes_per_group;
+	img->first_data_block = super->s_first_data_block;
+	img->num_groups = (super->s_blocks_count - img->first_data_block + img->blocks_per_group - 1) / img->blocks_per_group;
+
+	if (img->inode_size < EXT2_GOOD_OLD_INODE_SIZE || img->inode_size > img->block_size ||
+		img->blocks_per_group == 0 || img->inodes_per_group == 0) {
+        fprintf(stderr, "read_super_block: Bad Ext2 geometry\n");
+		free(img);
+		return NULL;
+	}
+
+	if (load_group_table(img) < 0) {
+        fprintf(stderr, "read_group_desc: No usable group-descriptor table\n");
+		free(img);
+		return NULL;
+	}
+
+	// Runs without the cache if the memory is not there
+	img->cache = block_cache_create(img->block_size);
+		
+	if (debug)
+	{
+		printf("Reading first super-block from device: \n"
+				"Block size                    : %u\n"
+				"Inode size                    : %u\n"
+				"number of inodes in a block   : %u\n"
+				"Inode table size in blocks    : %u\n"
+				"Blocks per group              : %u\n"
+				"number of block groups        : %u\n"
+				,
+				img->block_size,
+				img->inode_size,
+				img->inodes_per_block,
+				img->itable_blocks,
+				img->blocks_per_group,
+				img->num_groups);
+	}
+
+	return img;
+}
+
+/* release an image opened with ext2_read_init */
+void ext2_read_free(struct ext2_image *img)
+{
+	block_cache_free(img->cache);
+	free(img->groups);
+	free(img);
+}
+
 /* read the first super block */
-int read_super_block(int fd, int ngroup, struct ext2_super_block *super)
-{
-	// The groups that have copies of a super block are 0, 1 and powers of 3, 5 and 7
-    if (ngroup != 0 &&
-		ngroup != 1 &&
-		!isPowerOf(ngroup, 3) &&
-		!isPowerOf(ngroup, 5) &&
-		!isPowerOf(ngroup, 7) 
-		)
+int read_super_block(const struct ext2_image *img, int ngroup, struct ext2_super_block *super)
+{
+	// Only some groups carry a copy of the super block
+    if (ngroup < 0 || ngroup >= (int)img->num_groups || !group_has_super(img, ngroup))
 		{
 			if (debug)
 				printf("this block does not contain a super block copy");
 			return -1;
 		}
 
-		/*int num_no_super_copy_blocks = 0;
-		num_no_super_copy_blocks+=(ngroup > 0 ? 1 : 0);
-		num_no_super_copy_blocks+=(ngroup > 1 ? 1 : 0);
-		num_no_super_copy_blocks+=powersBelow(ngroup,3);
-		num_no_super_copy_blocks+=powersBelow(ngroup,5);
-		num_no_super_copy_blocks+=powersBelow(ngroup,7);*/
-    
-	
-	    lseek(fd, BASE_OFFSET + BLOCK_OFFSET(blocks_per_group * ngroup), SEEK_SET);        /* position head above super-block */
-        read(fd, super, sizeof(struct ext2_super_block));              /* read super-block */
-
-        if (super->s_magic != EXT2_SUPER_MAGIC) {
+		/* position head above super-block */
+		off_t offset = ngroup == 0 ? BASE_OFFSET : BLOCK_OFFSET(img, img->first_data_block + img->blocks_per_group * ngroup);
+        if (pread(img->fd, super, sizeof(struct ext2_super_block), offset) != sizeof(struct ext2_super_block) ||
+			super->s_magic != EXT2_SUPER_MAGIC) {
                 fprintf(stderr, "read_super_block: Not a Ext2 filesystem\n");
-                exit(1);
+                return -1;
         }
-
-        block_size = 1024 << super->s_log_block_size;
 		
 		if (debug)
 		{
@@ -133,7 +449,7 @@ int read_super_block(int fd, int ngroup, struct ext2_super_block *super)
 				   super->s_inodes_count,
 				   super->s_blocks_count,
 				   super->s_first_data_block,
-				   block_size,
+				   1024 << super->s_log_block_size,
 				   super->s_log_block_size,
 				   super->s_blocks_per_group,
 				   super->s_inodes_per_group,
@@ -141,30 +457,14 @@ int read_super_block(int fd, int ngroup, struct ext2_super_block *super)
 				   super->s_inode_size);
 		}
 		
-		
-		inodes_per_block = block_size / sizeof(struct ext2_inode);		/* number of inodes per block */
-		itable_blocks = super->s_inodes_per_group / inodes_per_block;		/* size in blocks of the inode table */
-		
 		return 0;
 }
 
 /* Read the group-descriptor in the block group*/
-void read_group_desc(int fd, int ngroup, struct ext2_group_desc *group)
-{
-		if (ngroup != 0 &&
-		ngroup != 1 &&
-		isPowerOf(ngroup, 3) &&
-		isPowerOf(ngroup, 5) &&
-		isPowerOf(ngroup, 7) 
-		)
-		{
-			lseek(fd, BASE_OFFSET + BLOCK_OFFSET(blocks_per_group * ngroup), SEEK_SET);
-		}
-		else
-		{
-			lseek(fd, BASE_OFFSET + BLOCK_OFFSET(blocks_per_group * ngroup) + block_size, SEEK_SET);
-		}
-        read(fd, group, sizeof(struct ext2_group_desc));
+void read_group_desc(const struct ext2_image *img, int ngroup, struct ext2_group_desc *group)
+{
+		// Served from the table loaded at ext2_read_init
+		*group = img->groups[ngroup];
 
 		if (debug)
 		{
@@ -186,29 +486,472 @@ void read_group_desc(int fd, int ngroup, struct ext2_group_desc *group)
 }
 
 /* calculate the start address of the inode table in the given group */
-off_t locate_inode_table(int ngroup, const struct ext2_group_desc *group)
+off_t locate_inode_table(const struct ext2_image *img, int ngroup)
 {
-		return BLOCK_OFFSET(group->bg_inode_table + blocks_per_group * ngroup);
+		return BLOCK_OFFSET(img, img->groups[ngroup].bg_inode_table);
 }
 
 /* calculate the start address of the data blocks in the given group */
-off_t locate_data_blocks(int ngroup, const struct ext2_group_desc *group)
+off_t locate_data_blocks(const struct ext2_image *img, int ngroup)
 {
-		return BLOCK_OFFSET(group->bg_inode_table + itable_blocks + blocks_per_group * ngroup);
+		return BLOCK_OFFSET(img, img->groups[ngroup].bg_inode_table + img->itable_blocks);
 }
 
-void read_inode(fd, offset, relative_inode_no, inode)
-     int                            fd;        			/* the floppy disk file descriptor */
+void read_inode(img, offset, relative_inode_no, inode)
+     const struct ext2_image       *img;      			/* the opened image */
      off_t 			   				offset;    			/* offset to the start of the inode table */
      int                            relative_inode_no;  /* the inode number to read  */
      struct ext2_inode             *inode;     			/* where to put the inode */
 {
-    lseek(fd, offset + (relative_inode_no-1)*sizeof(struct ext2_inode), SEEK_SET);
-    read(fd, inode, sizeof(struct ext2_inode));
+    pread(img->fd, inode, sizeof(struct ext2_inode), offset + (off_t)(relative_inode_no-1)*img->inode_size);
+}
+
+int read_data(const struct ext2_image *img, off_t offset, char* buffer, size_t len)
+{
+	return pread(img->fd, buffer, len, BLOCK_OFFSET(img, offset));
+}
+
+/* hint the kernel to start reading a block we are about to need */
+static void prefetch_block(const struct ext2_image *img, unsigned int block)
+{
+	if (block != 0)
+		posix_fadvise(img->fd, BLOCK_OFFSET(img, block), img->block_size, POSIX_FADV_WILLNEED);
+}
+
+/* number of data blocks addressed by one pointer at the given indirection level */
+static unsigned long long blocks_per_pointer(const struct ext2_image *img, int level)
+{
+	unsigned long long span = 1;
+	while (level-- > 0)
+		span *= img->block_size / sizeof(unsigned int);
+	return span;
+}
+
+/* walk one indirect block of the given level, calling fn for every data block below it */
+static int walk_indirect(const struct ext2_image *img, int level, unsigned int block, unsigned long long *lblock,
+						 unsigned long long nblocks, block_iter_fn fn, void *arg)
+{
+	unsigned int nptrs = img->block_size / sizeof(unsigned int);
+	int rc;
+
+	// A hole in the indirect tree stands for a hole over its whole span
+	if (block == 0) {
+		unsigned long long span = blocks_per_pointer(img, level);
+		while (span-- > 0 && *lblock < nblocks) {
+			if ((rc = fn(*lblock, 0, arg)) != 0)
+				return rc;
+			(*lblock)++;
+		}
+		return 0;
+	}
+
+	// ext2 allocates the blocks an indirect block maps right after it, so the
+	// read-ahead lands the first of them in the cache for the copy to find
+	unsigned int ptrs[nptrs];
+	if (read_block(img, block, (char *)ptrs, BLOCK_CACHE_AHEAD) != (int)img->block_size)
+		return -1;
+
+	for (unsigned int i = 0; i < nptrs && *lblock < nblocks; i++) {
+		if (level == 1) {
+			if ((rc = fn(*lblock, ptrs[i], arg)) != 0)
+				return rc;
+			(*lblock)++;
+			continue;
+		}
+
+		// Start fetching the next sibling while this subtree is being consumed
+		if (i + 1 < nptrs)
+			prefetch_block(img, ptrs[i + 1]);
+
+		if ((rc = walk_indirect(img, level - 1, ptrs[i], lblock, nblocks, fn, arg)) != 0)
+			return rc;
+	}
+
+	return 0;
+}
+
+/* size of an inode in bytes, regular files keep the high 32 bits in i_dir_acl on revision 1 images */
+unsigned long long inode_size(const struct ext2_image *img, const struct ext2_inode *inode)
+{
+	unsigned long long size = inode->i_size;
+
+	if (S_ISREG(inode->i_mode) && img->super.s_rev_level >= EXT2_DYNAMIC_REV)
+		size |= (unsigned long long)inode->i_dir_acl << 32;
+	return size;
+}
+
+/* walk every data block of an inode in file order, including triple indirect blocks */
+int iterate_inode_blocks(const struct ext2_image *img, const struct ext2_inode *inode, block_iter_fn fn, void *arg)
+{
+	unsigned long long nblocks = (inode_size(img, inode) + img->block_size - 1) / img->block_size;
+	unsigned long long lblock = 0;
+	int rc;
+
+	// Direct pointers first, kick off the single indirect block read meanwhile
+	if (nblocks > EXT2_NDIR_BLOCKS)
+		prefetch_block(img, inode->i_block[EXT2_IND_BLOCK]);
+
+	for (int j = 0; j < EXT2_NDIR_BLOCKS && lblock < nblocks; j++) {
+		if ((rc = fn(lblock, inode->i_block[j], arg)) != 0)
+			return rc;
+		lblock++;
+	}
+
+	// Single, double and triple indirect pointers
+	for (int level = 1; level <= 3 && lblock < nblocks; level++) {
+		if (level < 3)
+			prefetch_block(img, inode->i_block[EXT2_IND_BLOCK + level]);
+
+		if ((rc = walk_indirect(img, level, inode->i_block[EXT2_IND_BLOCK + level - 1],
+								&lblock, nblocks, fn, arg)) != 0)
+			return rc;
+	}
+
+	return 0;
+}
+
+/* check whether the bytes at the start of buf look like a directory entry */
+static int plausible_dirent(const struct ext2_image *img, const char *buf, unsigned int avail)
+{
+	const struct ext2_dir_entry_2 *dentry = (const struct ext2_dir_entry_2 *) buf;
+
+	if (avail < EXT2_DIR_REC_LEN(1))
+		return 0;
+	if (dentry->inode == 0 || dentry->inode > img->super.s_inodes_count)
+		return 0;
+	if (dentry->name_len == 0 || (unsigned int)EXT2_DIR_REC_LEN(dentry->name_len) > avail)
+		return 0;
+	if (dentry->rec_len % EXT2_DIR_PAD != 0 || dentry->rec_len < EXT2_DIR_REC_LEN(dentry->name_len))
+		return 0;
+
+	// Names never contain NUL or '/'
+	for (int i = 0; i < dentry->name_len; i++)
+		if (dentry->name[i] == '\0' || dentry->name[i] == '/')
+			return 0;
+
+	return 1;
+}
+
+/* report deleted entries left behind in the slack between two live entries */
+static int scan_slack(const struct ext2_image *img, const char *buf, unsigned int start, unsigned int end, dirent_iter_fn fn, void *arg)
+{
+	unsigned int offset = start;
+	int rc;
+
+	while (offset + EXT2_DIR_REC_LEN(1) <= end) {
+		const struct ext2_dir_entry_2 *dentry = (const struct ext2_dir_entry_2 *) &buf[offset];
+
+		if (!plausible_dirent(img, &buf[offset], end - offset)) {
+			offset += EXT2_DIR_PAD;
+			continue;
+		}
+
+		if ((rc = fn(dentry->inode, dentry->name, dentry->name_len, 1, arg)) != 0)
+			return rc;
+		offset += EXT2_DIR_REC_LEN(dentry->name_len);
+	}
+
+	return 0;
+}
+
+struct dir_walk {
+	const struct ext2_image *img;
+	dirent_iter_fn fn;
+	void *arg;
+};
+
+/* block iterator callback scanning one directory block */
+static int scan_dir_block(unsigned long long lblock, unsigned int pblock, void *arg)
+{
+	struct dir_walk *walk = (struct dir_walk *) arg;
+	char buf[walk->img->block_size];
+	unsigned int offset = 0;
+	int rc;
+	(void) lblock;
+
+	if (pblock == 0)
+		return 0;
+	if (read_data(walk->img, pblock, buf, walk->img->block_size) != (int)walk->img->block_size)
+		return -1;
+
+	// Follow the live chain by rec_len, looking into the slack each entry leaves behind
+	while (offset + EXT2_DIR_REC_LEN(1) <= walk->img->block_size) {
+		const struct ext2_dir_entry_2 *dentry = (const struct ext2_dir_entry_2 *) &buf[offset];
+		unsigned int rec_len = dentry->rec_len;
+
+		// A broken chain leaves the rest of the block to carving
+		if (rec_len < EXT2_DIR_REC_LEN(0) || rec_len % EXT2_DIR_PAD != 0 ||
+			offset + rec_len > walk->img->block_size || (unsigned int)EXT2_DIR_REC_LEN(dentry->name_len) > rec_len)
+			return scan_slack(walk->img, buf, offset, walk->img->block_size, walk->fn, walk->arg);
+
+		// The first entry of a block is deleted by zeroing its inode
+		if (dentry->inode != 0 && dentry->name_len != 0 &&
+			(rc = walk->fn(dentry->inode, dentry->name, dentry->name_len, 0, walk->arg)) != 0)
+			return rc;
+
+		if ((rc = scan_slack(walk->img, buf, offset + EXT2_DIR_REC_LEN(dentry->name_len),
+							 offset + rec_len, walk->fn, walk->arg)) != 0)
+			return rc;
+
+		offset += rec_len;
+	}
+
+	return 0;
+}
+
+/* walk every directory block, reporting live entries and deleted ones left in slack */
+int iterate_dir_entries(const struct ext2_image *img, const struct ext2_inode *inode, dirent_iter_fn fn, void *arg)
+{
+	struct dir_walk walk = { img, fn, arg };
+	return iterate_inode_blocks(img, inode, scan_dir_block, &walk);
 }
 
-int read_data(int fd, off_t offset, char* buffer, size_t len)
+/* Asynchronous read queue.
+ *
+ * With io_uring the queue keeps up to depth reads in flight and hands them
+ * back in whatever order the device completes them. Where io_uring is not
+ * available (old kernels, seccomp, non-Linux) the same interface is served
+ * by plain pread in submission order.
+ */
+
+#define READ_QUEUE_BATCH 8		/* submit to the kernel every this many requests */
+
+struct read_queue {
+	int fd;
+	unsigned int depth;
+	unsigned int pending;		/* submitted but not yet handed back */
+
+	/* pread fallback: FIFO of submitted requests */
+	struct read_req **fifo;
+	unsigned int fifo_head;
+
+	/* io_uring state, ring_fd is -1 when running on pread */
+	int ring_fd;
+	unsigned int to_submit;
+#ifdef __NR_io_uring_setup
+	unsigned int *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr, *cq_ptr;
+	size_t sq_size, cq_size, sqes_size;
+#endif
+};
+
+#ifdef __NR_io_uring_setup
+/* map the submission and completion rings of a freshly created io_uring */
+static int ring_setup(struct read_queue *q)
 {
-	lseek(fd, BLOCK_OFFSET(offset), SEEK_SET);
-	return read(fd, buffer, len);
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+
+	q->ring_fd = syscall(__NR_io_uring_setup, q->depth, &p);
+	if (q->ring_fd < 0)
+		return -1;
+
+	q->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	q->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (q->cq_size > q->sq_size)
+			q->sq_size = q->cq_size;
+		q->cq_size = q->sq_size;
+	}
+
+	q->sq_ptr = mmap(NULL, q->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+					 q->ring_fd, IORING_OFF_SQ_RING);
+	if (q->sq_ptr == MAP_FAILED)
+		goto fail;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		q->cq_ptr = q->sq_ptr;
+	} else {
+		q->cq_ptr = mmap(NULL, q->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+						 q->ring_fd, IORING_OFF_CQ_RING);
+		if (q->cq_ptr == MAP_FAILED) {
+			munmap(q->sq_ptr, q->sq_size);
+			goto fail;
+		}
+	}
+
+	q->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	q->sqes = mmap(NULL, q->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				   q->ring_fd, IORING_OFF_SQES);
+	if (q->sqes == MAP_FAILED) {
+		if (q->cq_ptr != q->sq_ptr)
+			munmap(q->cq_ptr, q->cq_size);
+		munmap(q->sq_ptr, q->sq_size);
+		goto fail;
+	}
+
+	q->sq_tail = (unsigned int *)((char *)q->sq_ptr + p.sq_off.tail);
+	q->sq_mask = (unsigned int *)((char *)q->sq_ptr + p.sq_off.ring_mask);
+	q->sq_array = (unsigned int *)((char *)q->sq_ptr + p.sq_off.array);
+	q->cq_head = (unsigned int *)((char *)q->cq_ptr + p.cq_off.head);
+	q->cq_tail = (unsigned int *)((char *)q->cq_ptr + p.cq_off.tail);
+	q->cq_mask = (unsigned int *)((char *)q->cq_ptr + p.cq_off.ring_mask);
+	q->cqes = (struct io_uring_cqe *)((char *)q->cq_ptr + p.cq_off.cqes);
+
+	// The kernel may round the ring up, never use more than we asked for
+	if (p.sq_entries < q->depth)
+		q->depth = p.sq_entries;
+	return 0;
+
+fail:
+	close(q->ring_fd);
+	q->ring_fd = -1;
+	return -1;
+}
+
+/* hand queued submissions to the kernel, optionally waiting for a completion */
+static int ring_enter(struct read_queue *q, unsigned int wait)
+{
+	int rc;
+	do {
+		rc = syscall(__NR_io_uring_enter, q->ring_fd, q->to_submit, wait,
+					 wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while (rc < 0 && errno == EINTR);
+
+	if (rc > 0)
+		q->to_submit -= rc;
+	return rc;
+}
+#endif
+
+/* create a read queue on the image, io_uring when possible unless use_pread is set */
+struct read_queue *read_queue_init(const struct ext2_image *img, unsigned int depth, int use_pread)
+{
+	struct read_queue *q = calloc(1, sizeof(struct read_queue));
+	if (q == NULL)
+		return NULL;
+
+	q->fd = img->fd;
+	q->depth = depth ? depth : 1;
+	q->ring_fd = -1;
+
+#ifdef __NR_io_uring_setup
+	if (!use_pread && ring_setup(q) == 0)
+		return q;
+#else
+	(void) use_pread;
+#endif
+
+	q->fifo = calloc(q->depth, sizeof(struct read_req *));
+	if (q->fifo == NULL) {
+		free(q);
+		return NULL;
+	}
+
+	if (debug)
+		printf("read_queue_init: io_uring unavailable, falling back to pread\n");
+	return q;
+}
+
+/* does the queue run on io_uring */
+int read_queue_async(const struct read_queue *q)
+{
+	return q->ring_fd >= 0;
+}
+
+/* how many more requests fit in the queue */
+unsigned int read_queue_space(const struct read_queue *q)
+{
+	return q->depth - q->pending;
+}
+
+/* queue a read, returns -1 if the queue is already full */
+int read_queue_submit(struct read_queue *q, struct read_req *req)
+{
+	if (q->pending == q->depth)
+		return -1;
+
+#ifdef __NR_io_uring_setup
+	if (q->ring_fd >= 0) {
+		unsigned int tail = *q->sq_tail;
+		unsigned int idx = tail & *q->sq_mask;
+		struct io_uring_sqe *sqe = &q->sqes[idx];
+
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = q->fd;
+		sqe->off = req->offset;
+		sqe->addr = (unsigned long)req->buf;
+		sqe->len = req->len;
+		sqe->user_data = (unsigned long)req;
+
+		q->sq_array[idx] = idx;
+		__atomic_store_n(q->sq_tail, tail + 1, __ATOMIC_RELEASE);
+		q->to_submit++;
+		q->pending++;
+
+		// Get the device working without waiting for the queue to fill up
+		if (q->to_submit >= READ_QUEUE_BATCH)
+			ring_enter(q, 0);
+		return 0;
+	}
+#endif
+
+	q->fifo[(q->fifo_head + q->pending) % q->depth] = req;
+	q->pending++;
+	return 0;
+}
+
+/* wait for any outstanding read to finish, NULL when nothing is pending */
+struct read_req *read_queue_complete(struct read_queue *q)
+{
+	struct read_req *req;
+
+	if (q->pending == 0)
+		return NULL;
+
+#ifdef __NR_io_uring_setup
+	if (q->ring_fd >= 0) {
+		for (;;) {
+			unsigned int head = *q->cq_head;
+
+			if (head != __atomic_load_n(q->cq_tail, __ATOMIC_ACQUIRE)) {
+				struct io_uring_cqe *cqe = &q->cqes[head & *q->cq_mask];
+
+				req = (struct read_req *)(unsigned long)cqe->user_data;
+				req->result = cqe->res;
+				__atomic_store_n(q->cq_head, head + 1, __ATOMIC_RELEASE);
+				q->pending--;
+
+				// Kernels before 5.6 lack IORING_OP_READ, serve those synchronously
+				if (req->result == -EINVAL)
+					req->result = pread(q->fd, req->buf, req->len, req->offset);
+				return req;
+			}
+
+			if (ring_enter(q, 1) < 0)
+				return NULL;
+		}
+	}
+#endif
+
+	req = q->fifo[q->fifo_head];
+	q->fifo_head = (q->fifo_head + 1) % q->depth;
+	q->pending--;
+
+	req->result = pread(q->fd, req->buf, req->len, req->offset);
+	return req;
+}
+
+/* drain and release a read queue */
+void read_queue_free(struct read_queue *q)
+{
+	while (read_queue_complete(q) != NULL)
+		;
+
+#ifdef __NR_io_uring_setup
+	if (q->ring_fd >= 0) {
+		munmap(q->sqes, q->sqes_size);
+		if (q->cq_ptr != q->sq_ptr)
+			munmap(q->cq_ptr, q->cq_size);
+		munmap(q->sq_ptr, q->sq_size);
+		close(q->ring_fd);
+	}
+#endif
+
+	free(q->fifo);
+	free(q);
 }
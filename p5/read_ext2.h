@@ -8,53 +8,167 @@
 #include "ext2_fs.h"
 
 #define BASE_OFFSET 1024                   /* locates beginning of the super block (first group) */
-#define BLOCK_OFFSET(block) (BASE_OFFSET + (block-1)*block_size)
-
-extern unsigned int block_size;		/* default 1kB block size */
-extern unsigned int inodes_per_block;			/* number of inodes per block */
-extern unsigned int itable_blocks;				/* size in blocks of the inode table */
-extern unsigned int blocks_per_group;		/* number of blocks per block group */
-extern unsigned int num_groups;				/* number of block groups in the image */
-extern unsigned int inodes_per_group;
+#define BLOCK_OFFSET(img, block) ((off_t)(block)*(img)->block_size)
 
 extern int debug;		//turn on/off debug prints
 
-/* read the first super block to initialize common variables */
-void ext2_read_init( int                      fd);
+#define BLOCK_CACHE_SIZE   (4 << 20)       /* bytes of metadata and first blocks kept in memory */
+#define BLOCK_CACHE_SHARDS 16              /* independently locked parts of the block cache */
+#define BLOCK_CACHE_AHEAD  8               /* most blocks read past the one asked for */
+
+struct block_cache;
+
+/* an opened ext2 image and the geometry read from its super block */
+struct ext2_image {
+	int                      fd;                /* the disk image file descriptor */
+	struct ext2_super_block  super;             /* the primary super block */
+	unsigned int             block_size;        /* 1kB, 2kB or 4kB */
+	unsigned int             inode_size;        /* size of an on-disk inode record */
+	unsigned int             inodes_per_block;  /* number of inodes per block */
+	unsigned int             itable_blocks;     /* size in blocks of the inode table */
+	unsigned int             blocks_per_group;  /* number of blocks per block group */
+	unsigned int             inodes_per_group;  /* number of inodes per block group */
+	unsigned int             num_groups;        /* number of block groups in the image */
+	unsigned int             first_data_block;  /* block holding the first super block */
+	struct ext2_group_desc  *groups;            /* the whole group-descriptor table */
+	struct block_cache      *cache;             /* recently read blocks, NULL if it could not be set up */
+};
+
+/* block cache counters */
+struct block_cache_stats {
+	unsigned long long       hits;              /* blocks served from memory */
+	unsigned long long       misses;            /* blocks read from the image */
+	unsigned long long       ahead;             /* extra blocks brought in by read-ahead */
+};
+
+/* the inode record at index i of a buffer holding a run of the inode table */
+#define INODE_AT(img, buf, i) ((struct ext2_inode *)((char *)(buf) + (size_t)(i)*(img)->inode_size))
+
+/* read the first super block and the group-descriptor table, NULL if fd is not an ext2 image */
+struct ext2_image *ext2_read_init( int                      fd);
+
+/* release an image opened with ext2_read_init, does not close fd */
+void ext2_read_free( struct ext2_image       *img);
+
+/* does the given block group hold a backup of the super block and descriptor table */
+int group_has_super( const struct ext2_image *img,       /* the opened image */
+					 int                      ngroup     /* which block group to check */
+					 );
 
 /* read the specified super block */
-int read_super_block( int                      fd,        /* the disk image file descriptor */
+int read_super_block( const struct ext2_image *img,       /* the opened image */
 					   int                      ngroup,        /* which block group to access */
 					  struct ext2_super_block *super      /* where to put the super block */
 					  );
 
 /* Read the group-descriptor in the specified block group */
-void read_group_desc( int                      fd,        /* the disk image file descriptor */
+void read_group_desc( const struct ext2_image *img,       /* the opened image */
 					   int                      ngroup,        /* which block group to access */
 					  struct ext2_group_desc *group     /* where to put the group-descriptor */
 					  );
 
 /* calculate the start address of the inode table in the specified group */
-off_t locate_inode_table(int                      ngroup,        /* which block group to access */
-					  const struct ext2_group_desc *group);      /* the first group-descriptor */
+off_t locate_inode_table(const struct ext2_image *img,       /* the opened image */
+					  int                      ngroup);       /* which block group to access */
 
 /* calculate the start address of the data blocks in the specified group */
-off_t locate_data_blocks(int                      ngroup,        /* which block group to access */
-					  const struct ext2_group_desc *group);      /* the first group-descriptor */
+off_t locate_data_blocks(const struct ext2_image *img,       /* the opened image */
+					  int                      ngroup);       /* which block group to access */
 
 /* read an inode with specified inode number and group number */
-void read_inode( int                           fd,        /* the disk image file descriptor */
+void read_inode( const struct ext2_image      *img,       /* the opened image */
 				 off_t 						   offset,    /* offset to the start of the inode table */
 				 int                           inode_no,  /* the inode number to read  */
 				 struct ext2_inode            *inode   /* where to put the inode */
 				 ); 
 
 /* read an inode with specified inode number and group number */
-int read_data( int                            fd,        /* the disk image file descriptor */
+int read_data( const struct ext2_image      *img,       /* the opened image */
 				 off_t 						  offset,    /* offset to the start of the inode table */
 				 char*                        buffer,  /* the buffer to put the read data into  */
 				 size_t            			  len   /* the size in bytes to read */
 				 ); 
 
+/* read one block through the block cache, pulling in up to ahead following blocks on a miss */
+int read_block( const struct ext2_image *img,       /* the opened image */
+				unsigned int             block,     /* the block to read */
+				char                    *buffer,    /* where to put the block */
+				unsigned int             ahead      /* following blocks the caller will want too */
+				);
+
+/* copy a block out of the cache without going to the image, returns 1 if it was there */
+int block_cache_lookup( const struct ext2_image *img,       /* the opened image */
+						unsigned int             block,     /* the block to look for */
+						char                    *buffer     /* where to put the block */
+						);
+
+/* sum the counters of every cache shard */
+void block_cache_stats( const struct ext2_image  *img,      /* the opened image */
+						struct block_cache_stats *stats     /* where to put the counters */
+						);
+
+/* size of an inode in bytes, including the high 32 bits large_file images keep for regular files */
+unsigned long long inode_size( const struct ext2_image *img,       /* the opened image */
+							   const struct ext2_inode *inode      /* the inode to size */
+							   );
+
+/* called for every data block of an inode in file order, a non-zero return stops the walk */
+typedef int (*block_iter_fn)(unsigned long long lblock,   /* logical block number within the file */
+							 unsigned int       pblock,   /* physical block number, 0 for a hole */
+							 void              *arg);
+
+/* walk the direct, single, double and triple indirect blocks of an inode */
+int iterate_inode_blocks( const struct ext2_image *img,       /* the opened image */
+						  const struct ext2_inode *inode,     /* the inode to walk */
+						  block_iter_fn            fn,        /* called for every data block */
+						  void                    *arg        /* passed through to fn */
+						  );
+
+/* called for every directory entry, name is not NUL-terminated and only valid during the call */
+typedef int (*dirent_iter_fn)(unsigned int  ino,        /* inode number the entry points at */
+							  const char   *name,       /* the entry name */
+							  int           name_len,   /* length of the name */
+							  int           hidden,     /* 1 for deleted entries found in slack space */
+							  void         *arg);
+
+/* walk every data block of a directory, reporting live entries and deleted ones left in slack */
+int iterate_dir_entries( const struct ext2_image *img,       /* the opened image */
+						 const struct ext2_inode *inode,     /* the directory inode */
+						 dirent_iter_fn           fn,        /* called for every entry */
+						 void                    *arg        /* passed through to fn */
+						 );
+
+/* one read handed to a read queue */
+struct read_req {
+	off_t                          offset;    /* byte offset in the image */
+	void                          *buf;       /* where to put the data */
+	size_t                         len;       /* the size in bytes to read */
+	int                            result;    /* bytes read or -errno, set on completion */
+	void                          *data;      /* caller's cookie */
+};
+
+struct read_queue;
+
+/* create a read queue on the image, backed by io_uring unless unavailable or use_pread is set */
+struct read_queue *read_queue_init( const struct ext2_image *img,  /* the opened image */
+									unsigned int  depth,     /* how many reads to keep in flight */
+									int           use_pread  /* force the synchronous pread backend */
+									);
+
+/* does the queue run on io_uring */
+int read_queue_async(const struct read_queue *q);
+
+/* how many more requests fit in the queue */
+unsigned int read_queue_space(const struct read_queue *q);
+
+/* queue a read, returns -1 if the queue is already full */
+int read_queue_submit(struct read_queue *q, struct read_req *req);
+
+/* wait for any outstanding read to complete, in any order, NULL when nothing is pending */
+struct read_req *read_queue_complete(struct read_queue *q);
+
+/* drain and release a read queue */
+void read_queue_free(struct read_queue *q);
+
 #endif
 
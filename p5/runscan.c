@@ -1,313 +1,971 @@
 #include <stdio.h>
 #include <dirent.h>
 #include <string.h>
+#include <getopt.h>
+#include <time.h>
 #include "ext2_fs.h"
 #include "read_ext2.h"
+#include "carve.h"
+#include "validate.h"
+#include "archive.h"
+#include "manifest.h"
+
+// Cut recovered files at their last end-of-file marker (-e)
+int trim_eof = 0;
+
+// Blocks of the inode table covered by one read
+#define ITABLE_CHUNK_BLOCKS 8
+
+// Reads kept in flight unless -q says otherwise
+#define DEFAULT_QUEUE_DEPTH 64
+
+#define USAGE "expected usage: ./runscan [-a] [-e] [-p] [-s] [-v] [-j workers] [-m manifest] [-q depth] [-t type,...|all] inputfile outputfile\n"
+
+// Timing and throughput counters reported with -s
+struct scan_stats {
+	double dir_scan;		// seconds spent walking directories
+	double copy;			// seconds spent copying files out
+	unsigned long long inodes;	// inodes looked at
+	unsigned long long dirs;	// directories walked
+	unsigned long long files;	// files recovered
+	unsigned long long unchanged;	// files kept from an earlier run (-m)
+	unsigned long long bytes;	// bytes copied out
+};
+
+int show_stats = 0;
+struct scan_stats stats;
+
+// Background JPEG validation (-v), NULL when disabled
+struct validate_pool *validator = NULL;
+int jpeg_type = -1;
+
+// Single archive the files are streamed into (-a), NULL when writing a directory
+struct archive *archive = NULL;
+
+// JPEGs checked inline while streaming into the archive (-a -v)
+int validate_inline = 0;
+unsigned int inline_broken = 0;
+
+// Manifest of an earlier run and the one being built (-m), NULL when disabled
+struct manifest *previous = NULL;
+struct manifest *current = NULL;
+
+// Monotonic clock in seconds
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Utility to find which known file type the first data block of an inode holds
+int inodetype(const struct ext2_image *img, const struct ext2_inode *inode) {
+	unsigned char buffer[img->block_size];
+
+	// The copy comes back for the first blocks right away, bring in the ones laid out after it
+	unsigned long long nblocks = (inode_size(img, inode) + img->block_size - 1) / img->block_size;
+	unsigned int ahead = 0;
+	while (ahead + 1 < EXT2_NDIR_BLOCKS && ahead + 1 < nblocks &&
+		   inode->i_block[ahead + 1] == inode->i_block[0] + ahead + 1)
+		ahead++;
+
+	int read = read_block(img, inode->i_block[0], (char *)buffer, ahead);
+
+	if (read <= 0) {
+		// Nothing to match against
+		return -1;
+	}
+
+	return carve_match(buffer, read);
+}
+
+// One data block read kept in flight while copying
+struct copy_slot {
+	struct read_req req;
+	char *buf;
+	int len;			// bytes of the block that belong to the file
+	int done;			// read has completed (or was a hole)
+};
+
+// Data block reads kept in flight while copying files out
+struct copy_pipe {
+	const struct ext2_image *img;	// the disk image
+	struct read_queue *queue;
+	struct copy_slot *slots;
+	unsigned int nslots;
+	char *buffers;			// nslots blocks, one per slot
+};
+
+// State carried across blocks while copying an inode out
+struct copy_state {
+	int out;			// the file being recovered into
+	unsigned long long to_read;	// bytes of the file still to copy
+	int type;			// carve type of the file
+	struct carve_end end;		// end-of-file marker seen so far
+	struct copy_pipe *pipe;
+	unsigned long long head;	// next block to write out
+	unsigned long long tail;	// next block to queue
+	int error;
+};
+
+// Set up the copy pipeline with depth reads in flight
+void initpipe(struct copy_pipe *pipe, const struct ext2_image *img, unsigned int depth, int use_pread) {
+	pipe->img = img;
+	pipe->queue = read_queue_init(img, depth, use_pread);
+	pipe->nslots = depth;
+	pipe->slots = calloc(depth, sizeof(struct copy_slot));
+	pipe->buffers = malloc((size_t)depth * img->block_size);
+
+	if (pipe->queue == NULL || pipe->slots == NULL || pipe->buffers == NULL) {
+		printf("runScan: out of memory\n");
+		exit(1);
+	}
 
-// Utility to check if image is jpg
-int isjpeg(char* buffer) {
-	int is_jpg = 0;
-
-	// Check if the JPEG magic numbers match
-	if (buffer[0] == (char)0xff &&
-    	buffer[1] == (char)0xd8 &&
-    	buffer[2] == (char)0xff &&
-    	(buffer[3] == (char)0xe0 ||
-     	buffer[3] == (char)0xe1 ||
-     	buffer[3] == (char)0xe8)) {
-		// Found JPEG image
-		is_jpg = 1;
-	}
-	return is_jpg;
+	for (unsigned int i = 0; i < depth; i++)
+		pipe->slots[i].buf = pipe->buffers + (size_t)i * img->block_size;
 }
 
-int isinodejpeg(int fd, off_t start_inode_table, int ino) {
-	struct ext2_inode inode;
+void freepipe(struct copy_pipe *pipe) {
+	read_queue_free(pipe->queue);
+	free(pipe->slots);
+	free(pipe->buffers);
+}
 
-	// Read the inode from the disk
-	read_inode(fd, start_inode_table, ino, &inode);
+// Write out the oldest queued block once its read (or any read before it) completes
+void flushslot(struct copy_state *state) {
+	struct copy_pipe *pipe = state->pipe;
+	struct copy_slot *slot = &pipe->slots[state->head % pipe->nslots];
+
+	// Reads finish in any order, park them until the head one is in
+	while (!slot->done) {
+		struct read_req *req = read_queue_complete(pipe->queue);
+		if (req == NULL) {
+			state->error = -1;
+			break;
+		}
+		((struct copy_slot *) req->data)->done = 1;
+	}
 
-	char buffer[block_size];
+	// A failed or short read fails the file before any of this block is written
+	if (slot->done && slot->req.result != slot->len)
+		state->error = -1;
 
-	int read = read_data(fd, inode.i_block[0], buffer, block_size);
+	if (!state->error) {
+		if (trim_eof)
+			carve_scan_end(state->type, &state->end, (unsigned char *)slot->buf, slot->len);
 
-	if (read < 0 || !isjpeg(buffer)) {
-		// Not a JPEG file
-		return 0;
+		// Write to output file buffer
+		if (archive != NULL)
+			archive_write(archive, slot->buf, slot->len);
+		else
+			write(state->out, slot->buf, slot->len);
 	}
 
-	return 1;
+	state->head++;
 }
 
-//Utiliy to copy data from inode ino to outdir
-int copydata(int fd, char* filename, off_t start_inode_table, int ino) {
-	struct ext2_inode inode;
+// Block iterator callback queueing the read of one data block
+int copyblock(unsigned long long lblock, unsigned int pblock, void *arg) {
+	struct copy_state *state = (struct copy_state *) arg;
+	struct copy_pipe *pipe = state->pipe;
+	unsigned int block_size = pipe->img->block_size;
+	(void) lblock;
+
+	// Every slot busy, the oldest block has to go out first
+	if (state->tail - state->head == pipe->nslots)
+		flushslot(state);
+
+	struct copy_slot *slot = &pipe->slots[state->tail % pipe->nslots];
+
+	// Copy the max(to_read, block_size) from the data block
+	slot->len = state->to_read > block_size ? (int)block_size : (int)state->to_read;
+	slot->req.result = slot->len;
+	slot->done = 1;
+
+	// Holes in sparse files read back as zeroes, blocks the type match already read come from the cache
+	if (pblock == 0) {
+		memset(slot->buf, 0, slot->len);
+	} else if (!block_cache_lookup(pipe->img, pblock, slot->buf)) {
+		slot->req.offset = BLOCK_OFFSET(pipe->img, pblock);
+		slot->req.buf = slot->buf;
+		slot->req.len = slot->len;
+		slot->req.data = slot;
+		slot->done = 0;
+
+		// The pipe never queues more than the queue holds, but fail the file rather than stall on it
+		if (read_queue_submit(pipe->queue, &slot->req) < 0) {
+			slot->req.result = -1;
+			slot->done = 1;
+			state->error = -1;
+		}
+	}
+
+	state->tail++;
+	state->to_read -= slot->len;
+
+	return state->error;
+}
 
-	// Read the inode from the disk
-	read_inode(fd, start_inode_table, ino, &inode);
+// Check a JPEG still sitting in the archive buffer, returns how much of it to keep
+unsigned long long checkmember(const char *name, unsigned long long size) {
+	size_t len, end = 0;
+	unsigned char *tmp;
+	const char *reason = "";
 
+	const unsigned char *data = archive_member(archive, &len, &tmp);
+	if (data == NULL)
+		return size;
+
+	enum jpeg_status status = jpeg_validate(data, len < size ? len : size, &end, &reason);
+	free(tmp);
+
+	if (status == JPEG_OK)
+		return end < size ? end : size;
+
+	fprintf(stderr, "runScan: %s is %s: %s\n", name,
+			status == JPEG_TRUNCATED ? "truncated" : "broken", reason);
+	inline_broken++;
+	return size;
+}
+
+// Copy an inode into the archive as member name
+int copymember(struct copy_pipe *pipe, char *name, const struct ext2_inode *inode, int type) {
+	unsigned long long size = inode_size(pipe->img, inode);
+	if (archive_begin(archive, name, size, inode->i_mtime) < 0)
+		return -1;
+
+	struct copy_state state = { -1, size, type, { 0 }, pipe, 0, 0, 0 };
+	int rc = iterate_inode_blocks(pipe->img, inode, copyblock, &state);
+
+	while (state.head < state.tail)
+		flushslot(&state);
+	if (rc == 0)
+		rc = state.error;
+
+	// Trimming and validation only ever shorten the member
+	if (rc == 0 && trim_eof && state.end.end > 0 && state.end.end < size)
+		size = state.end.end;
+	if (rc == 0 && validate_inline && type == jpeg_type)
+		size = checkmember(name, size);
+
+	// Nothing of a failed copy stays in the archive
+	if (rc != 0) {
+		archive_drop(archive);
+		return -1;
+	}
+
+	if (archive_end(archive, size) < 0)
+		rc = -1;
+
+	return rc;
+}
+
+//Utiliy to copy data from an inode to filename
+int copydata(struct copy_pipe *pipe, char* filename, const struct ext2_inode *inode, int type) {
 	// If not a regular file, skip
-	if (!S_ISREG(inode.i_mode))
+	if (!S_ISREG(inode->i_mode))
 		return -1;
 
 	// Nothing to copy
-	if (inode.i_blocks == 0)
+	if (inode->i_blocks == 0)
 		return 0;
 
+	if (archive != NULL)
+		return copymember(pipe, filename, inode, type);
+
 	// Create new file in out directory
 	int fd2write = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd2write < 0)
+		return -1;
 
-	// Copy image to out directory
-	int to_read = inode.i_size;
+	// Walk direct, indirect, double and triple indirect blocks in order
+	unsigned long long size = inode_size(pipe->img, inode);
+	struct copy_state state = { fd2write, size, type, { 0 }, pipe, 0, 0, 0 };
+	int rc = iterate_inode_blocks(pipe->img, inode, copyblock, &state);
 
-	// The current data block pointed to by the inode
-	int j = 0;
+	// Drain whatever is still in flight
+	while (state.head < state.tail)
+		flushslot(&state);
+	if (rc == 0)
+		rc = state.error;
 
-	// Use direct pointers first
-	while (j < EXT2_NDIR_BLOCKS && to_read > 0) {
-		char buffer[block_size];
+	// Drop whatever slack follows the last end-of-file marker
+	if (rc == 0 && trim_eof && state.end.end > 0 && state.end.end < size)
+		ftruncate(fd2write, state.end.end);
 
-		// Copy the max(to_read, block_size) from the data blocks
-		int read = read_data(fd, inode.i_block[j++], buffer, 
-			to_read > (int)block_size ? (int)block_size : to_read);
+	close(fd2write);
 
-		// Write to output file buffer
-		write(fd2write, buffer, read);
-		to_read -= read;
+	// A partial copy would pass for the whole file
+	if (rc != 0) {
+		unlink(filename);
+		return -1;
 	}
 
-	// Use the single indirect block to read
-	if(to_read > 0) {
-		unsigned int blocks[block_size/sizeof(unsigned int)];
+	return 0;
+}
 
-		unsigned int* arr = blocks;
+// A file name found in a directory block, the name lives in the recovery arena
+struct name_entry {
+	unsigned int ino;		// global inode number the entry points at
+	unsigned int name_off;		// offset of the NUL-terminated name in the arena
+	int hidden;			// deleted entry carved from directory slack
+};
+
+// Everything the single pass over the inode table learns about the image
+struct recovery {
+	char *outdir;			// where recovered files go
+	unsigned char *type;		// indexed by global inode number, carve type + 1 once copied out
+	unsigned int ninodes;		// size of the type index
+	struct name_entry *names;	// every directory entry seen so far
+	unsigned int nnames;
+	unsigned int cap_names;
+	char *arena;			// backing store for all names
+	size_t arena_len;
+	size_t arena_cap;
+};
+
+// Remember that directory entry name points at global inode ino
+void addname(struct recovery *rec, unsigned int ino, const char *name, int name_len, int hidden) {
+	// Grow the entry table and arena geometrically to keep appends cheap
+	if (rec->nnames == rec->cap_names) {
+		rec->cap_names = rec->cap_names ? rec->cap_names * 2 : 64;
+		rec->names = realloc(rec->names, rec->cap_names * sizeof(struct name_entry));
+	}
+	if (rec->arena_len + name_len + 1 > rec->arena_cap) {
+		while (rec->arena_len + name_len + 1 > rec->arena_cap)
+			rec->arena_cap = rec->arena_cap ? rec->arena_cap * 2 : 4096;
+		rec->arena = realloc(rec->arena, rec->arena_cap);
+	}
 
-		// Read one block of indirect blocks
-		read_data(fd, inode.i_block[EXT2_IND_BLOCK], (char *)blocks, block_size);
+	if (rec->names == NULL || rec->arena == NULL) {
+		printf("runScan: out of memory\n");
+		exit(1);
+	}
 
-		int iterations = block_size/sizeof(unsigned int);
+	rec->names[rec->nnames].ino = ino;
+	rec->names[rec->nnames].name_off = rec->arena_len;
+	rec->names[rec->nnames].hidden = hidden;
+	rec->nnames++;
 
-		while(iterations-- > 0 && to_read > 0) {
-			char buffer[block_size];
+	memcpy(rec->arena + rec->arena_len, name, name_len);
+	rec->arena_len += name_len;
+	rec->arena[rec->arena_len++] = '\0';
+}
 
-			// Copy the max(to_read, block_size) from the data blocks
-			int read = read_data(fd, *arr, buffer, 
-				to_read > (int)block_size ? (int)block_size : to_read);
+// Directory entry callback streaming live and hidden names into the name map
+int addentry(unsigned int ino, const char *name, int name_len, int hidden, void *arg) {
+	struct recovery *rec = (struct recovery *) arg;
 
-			// Write to output file buffer
-			write(fd2write, buffer, read);
-			to_read -= read;
-			arr++;
-		}
+	// Only keep entries that can point at a file we recovered
+	if (ino <= rec->ninodes)
+		addname(rec, ino, name, name_len, hidden);
 
-		// Need double indirect pointers
-		if (to_read > 0) {
-			unsigned int ind_blocks[block_size/sizeof(unsigned int)];
-			unsigned int* ind_arr = ind_blocks;
+	return 0;
+}
 
-			// Read one block of indirect blocks
-			read_data(fd, inode.i_block[EXT2_DIND_BLOCK], (char *)ind_blocks, block_size);
+// Fallback for filesystems without hard links: copy an already recovered file
+int copyfile(const char *src, const char *dst) {
+	int in = open(src, O_RDONLY);
+	if (in < 0)
+		return -1;
 
-			int out_iterations = block_size/sizeof(unsigned int);
+	int out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (out < 0) {
+		close(in);
+		return -1;
+	}
 
-			// Iterate over block of indirect pointers
-			while(out_iterations-- > 0 && to_read > 0) {
-				unsigned int blocks[block_size/sizeof(unsigned int)];
-				unsigned int* arr = blocks;
+	char buffer[1 << 16];
+	int len;
+	while ((len = read(in, buffer, sizeof(buffer))) > 0)
+		write(out, buffer, len);
 
-				// Read the pointers in this block
-				read_data(fd, *ind_arr, (char *)blocks, block_size);
+	close(in);
+	close(out);
+	return len;
+}
 
-				int iterations = block_size/sizeof(unsigned int);
+// Hash table of the names live directory entries use, slots hold indexes into rec->names or -1
+struct name_set {
+	int *slots;
+	unsigned int mask;
+};
+
+// FNV-1a of a NUL-terminated name
+unsigned int namehash(const char *name) {
+	unsigned int hash = 2166136261u;
+	while (*name)
+		hash = (hash ^ (unsigned char)*name++) * 16777619u;
+	return hash;
+}
 
-				// Iterate over block of direct pointers and copy data
-				while(iterations-- > 0 && to_read > 0) {
-					char buffer[block_size];
+// Look name up among the live names, returns its slot or the empty one it would go in
+int *findlive(struct recovery *rec, struct name_set *live, const char *name, int *found) {
+	unsigned int i = namehash(name) & live->mask;
 
-					// Copy the max(to_read, block_size) from the data blocks
-					int read = read_data(fd, *arr, buffer, 
-						to_read > (int)block_size ? (int)block_size : to_read);
+	while (live->slots[i] >= 0) {
+		if (strcmp(rec->arena + rec->names[live->slots[i]].name_off, name) == 0) {
+			*found = 1;
+			return &live->slots[i];
+		}
+		i = (i + 1) & live->mask;
+	}
 
-					// Write to output file buffer
-					write(fd2write, buffer, read);
-					to_read -= read;
-					arr++;
-				}
+	*found = 0;
+	return &live->slots[i];
+}
 
-				ind_arr++;
-			}
-		}
+// Collect the names of every live entry, at most half the table gets used
+void buildlive(struct recovery *rec, struct name_set *live) {
+	unsigned int size = 64;
+	while (size < 2 * rec->nnames)
+		size *= 2;
+
+	live->mask = size - 1;
+	live->slots = malloc(size * sizeof(int));
+	if (live->slots == NULL) {
+		printf("runScan: out of memory\n");
+		exit(1);
 	}
+	memset(live->slots, -1, size * sizeof(int));
 
-	close(fd2write);
+	for (unsigned int i = 0; i < rec->nnames; i++) {
+		int found;
+		if (rec->names[i].hidden)
+			continue;
 
-	return 0;
+		int *slot = findlive(rec, live, rec->arena + rec->names[i].name_off, &found);
+		if (!found)
+			*slot = i;
+	}
 }
 
-int main(int argc, char **argv) {
-	if (argc != 3) {
-		printf("expected usage: ./runscan inputfile outputfile\n");
-		exit(0);
-	}
-	
-	int fd;
+// Give every named file its real name by linking to the file-<ino>.<ext> copy
+void linknames(struct recovery *rec) {
+	struct name_set live;
+	buildlive(rec, &live);
 
-	// Open disk image
-	fd = open(argv[1], O_RDONLY);
-	if (fd < 0) {
-		printf("runScan: could not open disk image\n");
-		exit(0);
+	for (unsigned int i = 0; i < rec->nnames; i++) {
+		struct name_entry *entry = &rec->names[i];
+		int found;
+
+		if (!rec->type[entry->ino])
+			continue;
+
+		// A deleted entry may point at an inode reused since, it never takes a live name
+		if (entry->hidden) {
+			findlive(rec, &live, rec->arena + entry->name_off, &found);
+			if (found)
+				continue;
+		}
+
+		const char *ext = carve_types[rec->type[entry->ino] - 1].ext;
+
+		// The archive gets a hard link member pointing at the copy
+		if (archive != NULL) {
+			char member[64];
+			sprintf(member, "file-%u.%s", entry->ino, ext);
+			archive_link(archive, rec->arena + entry->name_off, member);
+			continue;
+		}
+
+		char src[255];
+		sprintf(src, "%s/file-%u.%s", rec->outdir, entry->ino, ext);
+
+		char filename[255 + EXT2_NAME_LEN];
+		sprintf(filename, "%s/%s", rec->outdir, rec->arena + entry->name_off);
+
+		// Later entries with the same name win among live or among hidden ones
+		unlink(filename);
+		if (link(src, filename) < 0)
+			copyfile(src, filename);
+
+		if (current != NULL)
+			manifest_add_name(current, rec->arena + entry->name_off);
 	}
 
-	// Fail if the output directory already exists
-	if (opendir(argv[2]) != NULL) {
-		printf("runScan: output directory already exists\n");
-		exit(0);
+	free(live.slots);
+}
+
+// Turn a comma separated list of carve type names into a type mask
+unsigned int parsetypes(char *list) {
+	unsigned int mask = 0;
+
+	if (strcmp(list, "all") == 0)
+		return (1u << carve_ntypes) - 1;
+
+	for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+		int type = carve_lookup(name);
+		if (type < 0) {
+			printf("runScan: unknown file type %s\n", name);
+			exit(0);
+		}
+		mask |= 1u << type;
 	}
 
-	// Create out directory
-	int dir = mkdir(argv[2], S_IRWXU);
-	if (dir < 0) {
-		printf("runScan: could not create output directory\n");
-		exit(0);
+	return mask;
+}
+
+// Keep the copy an earlier run made of an inode if the inode has not changed since
+int unchanged(struct recovery *rec, const struct ext2_inode *inode, unsigned int ino,
+			  unsigned long long size, unsigned long long hash) {
+	const struct manifest_entry *entry = &previous->entries[ino];
+
+	if (entry->type == 0 || hash == 0 || entry->hash != hash ||
+		entry->generation != inode->i_version || entry->size != size)
+		return 0;
+
+	// The copy has to still be there
+	char filename[255];
+	sprintf(filename, "%s/file-%u.%s", rec->outdir, ino, carve_types[entry->type - 1].ext);
+	if (access(filename, F_OK) < 0)
+		return 0;
+
+	current->entries[ino] = *entry;
+	rec->type[ino] = entry->type;
+	stats.unchanged++;
+	return 1;
+}
+
+// Drop the names an earlier run linked and its copies of inodes that no longer
+// hold the same kind of file, the names still in use are linked again afterwards
+void dropstale(struct recovery *rec) {
+	char filename[255 + EXT2_NAME_LEN];
+
+	for (size_t off = 0; off < previous->names_len; off += strlen(previous->names + off) + 1) {
+		sprintf(filename, "%s/%s", rec->outdir, previous->names + off);
+		unlink(filename);
 	}
 
-	// Initialize the ext2 reader
-	ext2_read_init(fd);
+	for (unsigned int ino = 1; ino <= previous->ninodes; ino++) {
+		unsigned int type = previous->entries[ino].type;
+		if (type == 0 || type == current->entries[ino].type)
+			continue;
 
-	struct ext2_super_block super;
-	// Just read the first superblock
-	read_super_block(fd, 0, &super);
+		sprintf(filename, "%s/file-%u.%s", rec->outdir, ino, carve_types[type - 1].ext);
+		unlink(filename);
+	}
+}
 
-	/* PART 1 */
+// Recover a single inode read from the inode table
+void scaninode(struct copy_pipe *pipe, struct recovery *rec, const struct ext2_inode *inode, unsigned int ino) {
+	stats.inodes++;
 
-	int global_ino = 0;
+	if (inode->i_blocks == 0)
+		return;
 
-	// Iterate over all groups to find jpg files
-	for (unsigned int ngroup = 0; ngroup < 1; ngroup++) {
-		struct ext2_group_desc* group = (struct ext2_group_desc *) malloc(sizeof(struct ext2_group_desc));
+	if (S_ISDIR(inode->i_mode)) {
+		double start = now();
+		iterate_dir_entries(pipe->img, inode, addentry, rec);
+		stats.dir_scan += now() - start;
+		stats.dirs++;
+		return;
+	}
 
-		// Read the group descriptors
-		read_group_desc(fd, ngroup, group);
+	// If not a regular file, skip
+	if (!S_ISREG(inode->i_mode))
+		return;
+
+	// Only the block map is read for inodes an earlier run already copied
+	unsigned long long size = inode_size(pipe->img, inode);
+	unsigned long long hash = 0;
+	if (current != NULL && previous->entries[ino].type != 0) {
+		hash = block_map_hash(pipe->img, inode);
+		if (unchanged(rec, inode, ino, size, hash))
+			return;
+	}
 
-		// Get the first inode table block in the group
-		off_t start_inode_table = locate_inode_table(ngroup, group);
+	int type = inodetype(pipe->img, inode);
+	if (type < 0)
+		return;
+
+	// The copy walks the same indirect blocks again and finds them cached
+	if (current != NULL && hash == 0)
+		hash = block_map_hash(pipe->img, inode);
+
+	// Archive members sit at the top level, files go inside the output directory
+	char filename[255];
+	if (archive != NULL)
+		sprintf(filename, "file-%u.%s", ino, carve_types[type].ext);
+	else
+		sprintf(filename, "%s/file-%u.%s", rec->outdir, ino, carve_types[type].ext);
+
+	// Copy data of this inode to the outfile
+	double start = now();
+	int rc = copydata(pipe, filename, inode, type);
+	stats.copy += now() - start;
+
+	// A failed or short read leaves nothing behind, the inode is not recovered
+	if (rc != 0) {
+		fprintf(stderr, "runScan: could not recover %s\n", filename);
+		return;
+	}
+	stats.files++;
+	stats.bytes += size;
 
-		// Iterate over all inodes to check for JPEGs
-    	for (unsigned int ino = 1; ino < inodes_per_group; ino++) {
-			// ino is relative to the block
-			struct ext2_inode inode;
+	// Check the marker stream while the next files are being copied
+	if (validator != NULL && type == jpeg_type)
+		validate_submit(validator, filename);
 
-			// Read the inode from the disk
-            read_inode(fd, start_inode_table, ino, &inode);
+	rec->type[ino] = type + 1;
 
-			if (inode.i_blocks == 0)
-				continue;
+	// Only successful copies reach the manifest, so a read error gets the file copied again next run
+	if (current != NULL)
+		current->entries[ino] = (struct manifest_entry) { inode->i_version, type + 1, size, hash };
+}
 
-			// If not a regular file, skip
-			if (!S_ISREG(inode.i_mode))
-				continue;
+// A run of the inode table read in one request
+struct itable_chunk {
+	struct read_req req;
+	unsigned int first;		// first inode in the chunk, relative to the group
+	int done;			// the read has completed
+	char *table;			// raw inode records, img->inode_size bytes apart
+};
+
+// Queue the read of the stretch of the inode table starting at inode first
+int submitchunk(struct read_queue *queue, struct itable_chunk *chunk, off_t start_inode_table,
+				unsigned int first, unsigned int inode_size) {
+	chunk->first = first;
+	chunk->done = 0;
+	chunk->req.offset = start_inode_table + (off_t)(first - 1) * inode_size;
+	return read_queue_submit(queue, &chunk->req);
+}
 
-	        /* The maximum index of the i_block array should be computed from i_blocks / ((1024<<s_log_block_size)/512)
-			 * or once simplified, i_blocks/(2<<s_log_block_size)
-			 * https://www.nongnu.org/ext2-doc/ext2.html#i-blocks
-			 */
+// Read whatever part of a chunk its queued read did not return, returns how many of
+// the wanted inodes are there
+unsigned int fillchunk(const struct ext2_image *img, struct itable_chunk *chunk, unsigned int wanted) {
+	size_t want = (size_t)wanted * img->inode_size;
+	size_t got = chunk->req.result > 0 ? (size_t)chunk->req.result : 0;
+
+	while (got < want) {
+		ssize_t n = pread(img->fd, chunk->table + got, want - got, chunk->req.offset + got);
+		if (n <= 0)
+			break;
+		got += n;
+	}
 
-			//unsigned int i_blocks = inode.i_blocks/(2<<super.s_log_block_size);
+	return got < want ? got / img->inode_size : wanted;
+}
 
-			char buffer[block_size];
+// Scan the inode table of a group, keeping several chunk reads in flight. Chunks are
+// processed in table order so names are collected the same way on every run.
+// Returns -1 if part of the table could not be queued
+int scangroup(struct read_queue *queue, struct itable_chunk *chunks, unsigned int nchunks,
+			  off_t start_inode_table, unsigned int global_ino,
+			  struct copy_pipe *pipe, struct recovery *rec) {
+	const struct ext2_image *img = pipe->img;
+	unsigned int inodes_per_group = img->inodes_per_group;
+	unsigned int per_chunk = img->inodes_per_block * ITABLE_CHUNK_BLOCKS;
+	unsigned int next = 1;
+	unsigned int head = 0, tail = 0;
+	int rc = 0;
+
+	for (; tail < nchunks && next <= inodes_per_group; tail++, next += per_chunk) {
+		if (submitchunk(queue, &chunks[tail], start_inode_table, next, img->inode_size) < 0) {
+			rc = -1;
+			break;
+		}
+	}
 
-			int read = read_data(fd, inode.i_block[0], buffer, block_size);
+	while (head < tail) {
+		struct itable_chunk *chunk = &chunks[head % nchunks];
+
+		// Reads finish in any order, park them until the oldest chunk is in
+		while (!chunk->done) {
+			struct read_req *req = read_queue_complete(queue);
+			if (req == NULL) {
+				// Nothing may still land in the chunks once the next group reuses them
+				while (read_queue_complete(queue) != NULL)
+					;
+				return -1;
+			}
+			((struct itable_chunk *) req->data)->done = 1;
+		}
 
-			if (read < 0 || !isjpeg(buffer)) {
-				// Not a JPEG file
+		// The last chunk runs past the end of the group's table
+		unsigned int wanted = inodes_per_group - chunk->first + 1;
+		if (wanted > per_chunk)
+			wanted = per_chunk;
+
+		// Failed or short reads get another try with pread before inodes are given up on
+		unsigned int count = fillchunk(img, chunk, wanted);
+		if (count < wanted)
+			printf("runScan: could not read inodes %u to %u, skipping them\n",
+				   global_ino + chunk->first + count, global_ino + chunk->first + wanted - 1);
+
+		for (unsigned int i = 0; i < count; i++)
+			scaninode(pipe, rec, INODE_AT(img, chunk->table, i), global_ino + chunk->first + i);
+		head++;
+
+		// Reuse the chunk for the next stretch of the table
+		if (rc == 0 && next <= inodes_per_group) {
+			if (submitchunk(queue, &chunks[tail % nchunks], start_inode_table, next, img->inode_size) < 0) {
+				rc = -1;
 				continue;
 			}
+			tail++;
+			next += per_chunk;
+		}
+	}
 
-			//printf("runscan: found jpeg file at inode %u\n", ino + global_ino);
-
-			char filename[255];
-			sprintf(filename, "%s/file-%d.jpg", argv[2], ino + global_ino);
+	return rc;
+}
 
-			// Copy data of this inode to the outfile
-			copydata(fd, filename, start_inode_table, ino);
-        }
+int main(int argc, char **argv) {
+	// Only JPEGs are carved unless asked otherwise
+	unsigned int types = 1u << carve_lookup("jpeg");
+
+	unsigned int depth = DEFAULT_QUEUE_DEPTH;
+	int use_pread = 0;
+	int validate = 0;
+	int to_archive = 0;
+	char *manifest = NULL;
+	int reuse = 0;
+	int nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+
+	int opt;
+	while ((opt = getopt(argc, argv, "aepsvj:m:q:t:")) != -1) {
+		switch (opt) {
+			case 'a':
+				to_archive = 1;
+				break;
+			case 'e':
+				trim_eof = 1;
+				break;
+			case 'p':
+				use_pread = 1;
+				break;
+			case 's':
+				show_stats = 1;
+				break;
+			case 'v':
+				validate = 1;
+				break;
+			case 'j':
+				nworkers = atoi(optarg);
+				if (nworkers <= 0 || nworkers > 256) {
+					printf("runScan: worker count must be between 1 and 256\n");
+					exit(0);
+				}
+				break;
+			case 'm':
+				manifest = optarg;
+				break;
+			case 'q':
+				depth = atoi(optarg);
+				if (depth == 0 || depth > 4096) {
+					printf("runScan: queue depth must be between 1 and 4096\n");
+					exit(0);
+				}
+				break;
+			case 't':
+				types = parsetypes(optarg);
+				break;
+			default:
+				printf(USAGE);
+				exit(0);
+		}
+	}
 
-		// Increment global count after iterating over group
-		global_ino += inodes_per_group;
+	if (argc - optind != 2) {
+		printf(USAGE);
+		exit(0);
 	}
 
-	/* PART 2 */
+	char *image = argv[optind];
+	char *outdir = argv[optind + 1];
 
-	// Iterate over all directories to find jpg file names
-	for (unsigned int ngroup = 0; ngroup < 1; ngroup++) {
-		struct ext2_group_desc* group = (struct ext2_group_desc *) malloc(sizeof(struct ext2_group_desc));
+	carve_init(types);
+	jpeg_type = carve_lookup("jpeg");
+	
+	int fd;
 
-		// Read the group descriptors
-		read_group_desc(fd, ngroup, group);
+	// Open disk image
+	fd = open(image, O_RDONLY);
+	if (fd < 0) {
+		printf("runScan: could not open disk image\n");
+		exit(0);
+	}
 
-		// Get the first inode table block in the group
-		off_t start_inode_table = locate_inode_table(ngroup, group);
+	// A rescan fills in the directory of the earlier run, an archive always starts empty
+	if (manifest != NULL && to_archive) {
+		printf("runScan: -m cannot be combined with -a\n");
+		exit(0);
+	}
 
-		// Iterate over all inodes in the group
-    	for (unsigned int ino = 1; ino < inodes_per_group; ino++) {
-			// ino is relative to the block
-			struct ext2_inode inode;
+	// Stream everything into one archive file instead of a directory
+	if (to_archive) {
+		archive = archive_open(outdir);
+		if (archive == NULL) {
+			printf("runScan: could not create output archive\n");
+			exit(0);
+		}
+	}
 
-			// Read the inode from the disk
-            read_inode(fd, start_inode_table, ino, &inode);
+	// Fail if the output directory already exists, unless it is being rescanned
+	else if (opendir(outdir) != NULL) {
+		if (manifest == NULL) {
+			printf("runScan: output directory already exists\n");
+			exit(0);
+		}
+		reuse = 1;
+	}
 
-			if (inode.i_blocks == 0)
-				continue;
+	// Create out directory
+	else if (mkdir(outdir, S_IRWXU) < 0) {
+		printf("runScan: could not create output directory\n");
+		exit(0);
+	}
 
-			// If not a directory, skip
-			if (!S_ISDIR(inode.i_mode))
-				continue;
+	// Initialize the ext2 reader, loads the super block and group-descriptor table
+	struct ext2_image *img = ext2_read_init(fd);
+	if (img == NULL)
+		exit(1);
+
+	struct recovery rec = { 0 };
+	rec.outdir = outdir;
+	rec.ninodes = img->super.s_inodes_count;
+	rec.type = calloc(rec.ninodes + 1, 1);
+
+	// Records only carry over between runs that would recover the same bytes
+	if (manifest != NULL) {
+		unsigned int options = types | trim_eof << 16 | validate << 17;
+		previous = manifest_load(manifest, rec.ninodes, options);
+		current = manifest_new(rec.ninodes, options);
+		if (previous == NULL || current == NULL) {
+			printf("runScan: out of memory\n");
+			exit(1);
+		}
 
-			char buffer[block_size];
+		// Without a matching manifest there is no telling which files in the directory are stale
+		if (reuse && !previous->loaded) {
+			printf("runScan: output directory already exists and manifest %s is missing or does not match this run\n", manifest);
+			exit(0);
+		}
+	}
 
-			// Read the first data block of directory, guaranteed to be in only one data block
-			read_data(fd, inode.i_block[0], buffer, block_size);
-			unsigned int offset = 0;
+	// Data block reads for copying files out
+	struct copy_pipe pipe;
+	initpipe(&pipe, img, depth, use_pread);
 
-			while (offset < block_size) {
+	// Inode table reads, each chunk covering ITABLE_CHUNK_BLOCKS blocks of the table
+	unsigned int nchunks = depth / ITABLE_CHUNK_BLOCKS > 2 ? depth / ITABLE_CHUNK_BLOCKS : 2;
+	struct read_queue *scanqueue = read_queue_init(img, nchunks, use_pread);
+	if (scanqueue == NULL) {
+		printf("runScan: out of memory\n");
+		exit(1);
+	}
 
-				// Read the first dir ent
-				struct ext2_dir_entry* dentry = (struct ext2_dir_entry*) &(buffer[offset]);
+	unsigned int idle = read_queue_space(scanqueue);
 
-				int name_len = dentry->name_len & 0xFF; // convert 2 bytes to 4 bytes properly
+	struct itable_chunk chunks[nchunks];
+	for (unsigned int i = 0; i < nchunks; i++) {
+		chunks[i].req.len = (size_t)img->block_size * ITABLE_CHUNK_BLOCKS;
+		chunks[i].table = malloc(chunks[i].req.len);
+		chunks[i].req.buf = chunks[i].table;
+		chunks[i].req.data = &chunks[i];
 
-				if (name_len <= 0)
-					break;
+		if (chunks[i].table == NULL) {
+			printf("runScan: out of memory\n");
+			exit(1);
+		}
+	}
 
-				char name[EXT2_NAME_LEN];
-				strncpy(name, dentry->name, name_len);
-				name[name_len] = '\0';
+	if (debug)
+		printf("runScan: reading through %s\n", read_queue_async(scanqueue) ? "io_uring" : "pread");
 
-				// If inode is JPEG, copy to out directory
+	// The archive streams through one buffer, so its files are checked inline
+	if (validate && archive != NULL) {
+		validate_inline = 1;
+	} else if (validate) {
+		validator = validate_start(nworkers > 0 ? nworkers : 1);
+		if (validator == NULL)
+			printf("runScan: could not start validation workers, skipping validation\n");
+	}
 
-				// This ino is global ino, subtract from groups per block * ngroup to get relative
-				int ino = dentry->inode;
+	unsigned int global_ino = 0;
+	double scan_start = now();
 
-				int rel_ino = ino - (inodes_per_group * ngroup);
+	// Single pass: copy every carved file out once and collect directory names on the way
+	for (unsigned int ngroup = 0; ngroup < img->num_groups; ngroup++) {
+		// Get the first inode table block in the group
+		off_t start_inode_table = locate_inode_table(img, ngroup);
 
-				if (isinodejpeg(fd, start_inode_table, rel_ino)) {
-					char filename[255 + EXT2_NAME_LEN];
-					sprintf(filename, "%s/%s", argv[2], name);
+		if (scangroup(scanqueue, chunks, nchunks, start_inode_table, global_ino, &pipe, &rec) < 0) {
+			printf("runScan: could not read the inode table of group %u\n", ngroup);
 
-					// Copy the  data contained in the inode to the outdir
-					copydata(fd, filename, start_inode_table, rel_ino);
-				}
+			// Reads that never completed could still land in the chunks, stop using them
+			if (read_queue_space(scanqueue) != idle) {
+				printf("runScan: inode table reads are stuck, stopping the scan\n");
+				break;
+			}
+		}
 
-				// Rounding up name_len to powers of 4
-				name_len = ((name_len + 3)/4) * 4;
+		// Increment global count after iterating over group
+		global_ino += img->inodes_per_group;
+	}
 
-				// Finding hidden entries by offsetting through name_len instead of rec_len
-				offset += name_len + 8;
-			}
-        }
+	// Validation may truncate files, let it settle before names are linked or copied
+	unsigned int broken = 0;
+	if (validator != NULL)
+		broken = validate_finish(validator);
+	broken += inline_broken;
+
+	double link_start = now();
+
+	if (current != NULL)
+		dropstale(&rec);
+
+	// Named copies share the data already written out
+	linknames(&rec);
+
+	if (current != NULL && manifest_save(current, manifest) < 0)
+		printf("runScan: could not write manifest %s\n", manifest);
+
+	if (archive != NULL && archive_close(archive) < 0)
+		printf("runScan: could not write output archive\n");
+
+	if (validate && broken > 0)
+		printf("runScan: %u recovered jpeg images failed validation\n", broken);
+
+	if (show_stats) {
+		double scan = link_start - scan_start;
+		double link = now() - link_start;
+		double inode_scan = scan - stats.dir_scan - stats.copy;
+
+		struct block_cache_stats cache;
+		block_cache_stats(img, &cache);
+
+		fprintf(stderr,
+				"runScan: %llu inodes, %llu directories, %llu files, %llu unchanged, %.1f MB recovered\n"
+				"inode scan : %9.3f s %12.0f inodes/s\n"
+				"dir scan   : %9.3f s %12llu dirs\n"
+				"copy       : %9.3f s %12.1f MB/s\n"
+				"link       : %9.3f s %12u names\n"
+				"cache      : %9llu hits %9llu misses %5.1f%% hit rate, %llu read ahead\n"
+				"total      : %9.3f s %12.1f MB/s\n",
+				stats.inodes, stats.dirs, stats.files, stats.unchanged, stats.bytes / 1e6,
+				inode_scan, inode_scan > 0 ? stats.inodes / inode_scan : 0,
+				stats.dir_scan, stats.dirs,
+				stats.copy, stats.copy > 0 ? stats.bytes / 1e6 / stats.copy : 0,
+				link, rec.nnames,
+				cache.hits, cache.misses,
+				cache.hits + cache.misses > 0 ? 100.0 * cache.hits / (cache.hits + cache.misses) : 0,
+				cache.ahead,
+				scan + link, scan + link > 0 ? stats.bytes / 1e6 / (scan + link) : 0);
 	}
-	
+
+	for (unsigned int i = 0; i < nchunks; i++)
+		free(chunks[i].table);
+	read_queue_free(scanqueue);
+	freepipe(&pipe);
+
+	manifest_free(previous);
+	manifest_free(current);
+	free(rec.type);
+	free(rec.names);
+	free(rec.arena);
+
+	ext2_read_free(img);
 	close(fd);
 
 	printf("runScan: done recovering jpeg images\n");
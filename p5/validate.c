@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include "validate.h"
+
+/* JPEG marker codes we care about */
+#define M_SOI  0xd8
+#define M_EOI  0xd9
+#define M_SOS  0xda
+#define M_TEM  0x01
+#define IS_RST(m) ((m) >= 0xd0 && (m) <= 0xd7)
+
+/* find the next 0xff byte, entropy coded data is scanned a vector at a time */
+static const unsigned char *find_ff(const unsigned char *p, const unsigned char *end)
+{
+#ifdef __AVX2__
+	const __m256i ff32 = _mm256_set1_epi8((char)0xff);
+	while (end - p >= 32) {
+		unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), ff32));
+		if (mask)
+			return p + __builtin_ctz(mask);
+		p += 32;
+	}
+#endif
+#ifdef __SSE2__
+	const __m128i ff16 = _mm_set1_epi8((char)0xff);
+	while (end - p >= 16) {
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), ff16));
+		if (mask)
+			return p + __builtin_ctz(mask);
+		p += 16;
+	}
+#endif
+	return memchr(p, 0xff, end - p);
+}
+
+/* walk the marker segments of a JPEG, setting *end just past EOI when found */
+enum jpeg_status jpeg_validate(const unsigned char *buf, size_t len, size_t *end, const char **reason)
+{
+	const unsigned char *p = buf;
+	const unsigned char *stop = buf + len;
+	int seen_sos = 0;
+
+	*end = 0;
+
+	if (len < 2 || buf[0] != 0xff || buf[1] != M_SOI) {
+		*reason = "missing SOI";
+		return JPEG_BROKEN;
+	}
+	p += 2;
+
+	for (;;) {
+		if (p >= stop) {
+			*reason = "no EOI";
+			return JPEG_TRUNCATED;
+		}
+		if (*p != 0xff) {
+			*reason = "garbage between segments";
+			return JPEG_BROKEN;
+		}
+
+		// Any number of 0xff fill bytes may precede a marker
+		while (p < stop && *p == 0xff)
+			p++;
+		if (p >= stop) {
+			*reason = "no EOI";
+			return JPEG_TRUNCATED;
+		}
+
+		unsigned char marker = *p++;
+
+		if (marker == M_EOI) {
+			if (!seen_sos) {
+				*reason = "no SOS before EOI";
+				return JPEG_BROKEN;
+			}
+			*end = p - buf;
+			return JPEG_OK;
+		}
+
+		// Standalone markers carry no length
+		if (IS_RST(marker) || marker == M_TEM)
+			continue;
+
+		if (marker == M_SOI || marker == 0x00) {
+			*reason = "unexpected marker";
+			return JPEG_BROKEN;
+		}
+
+		if (stop - p < 2) {
+			*reason = "segment header cut short";
+			return JPEG_TRUNCATED;
+		}
+
+		size_t seglen = (p[0] << 8) | p[1];
+		if (seglen < 2) {
+			*reason = "bad segment length";
+			return JPEG_BROKEN;
+		}
+		if ((size_t)(stop - p) < seglen) {
+			*reason = "segment cut short";
+			return JPEG_TRUNCATED;
+		}
+		p += seglen;
+
+		if (marker != M_SOS)
+			continue;
+		seen_sos = 1;
+
+		// Entropy coded data runs until a 0xff that is not stuffing or a restart marker
+		for (;;) {
+			const unsigned char *ff = find_ff(p, stop);
+			if (ff == NULL || ff + 1 >= stop) {
+				*reason = "scan data without EOI";
+				return JPEG_TRUNCATED;
+			}
+			if (ff[1] == 0x00 || IS_RST(ff[1])) {
+				p = ff + 2;
+				continue;
+			}
+			if (ff[1] == 0xff) {
+				p = ff + 1;
+				continue;
+			}
+			p = ff;
+			break;
+		}
+	}
+}
+
+/* a file waiting for a worker */
+struct validate_job {
+	struct validate_job *next;
+	char path[];
+};
+
+struct validate_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	struct validate_job *head;
+	struct validate_job *tail;
+	int done;			/* no more jobs will be queued */
+	unsigned int broken;
+	int nworkers;
+	pthread_t workers[];
+};
+
+/* validate one recovered file, truncating slack after EOI */
+static int validate_file(const char *path)
+{
+	int fd = open(path, O_RDWR);
+	if (fd < 0)
+		return 0;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	unsigned char *buf = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (buf == MAP_FAILED) {
+		close(fd);
+		return 0;
+	}
+
+	size_t end;
+	const char *reason = NULL;
+	enum jpeg_status status = jpeg_validate(buf, st.st_size, &end, &reason);
+	munmap(buf, st.st_size);
+
+	if (status == JPEG_OK && end < (size_t)st.st_size)
+		ftruncate(fd, end);
+	close(fd);
+
+	if (status != JPEG_OK) {
+		fprintf(stderr, "runScan: %s is %s: %s\n", path,
+				status == JPEG_TRUNCATED ? "truncated" : "broken", reason);
+		return 1;
+	}
+	return 0;
+}
+
+static void *validate_worker(void *arg)
+{
+	struct validate_pool *pool = (struct validate_pool *) arg;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (pool->head == NULL && !pool->done)
+			pthread_cond_wait(&pool->ready, &pool->lock);
+
+		struct validate_job *job = pool->head;
+		if (job == NULL) {
+			pthread_mutex_unlock(&pool->lock);
+			return NULL;
+		}
+		pool->head = job->next;
+		if (pool->head == NULL)
+			pool->tail = NULL;
+		pthread_mutex_unlock(&pool->lock);
+
+		int broken = validate_file(job->path);
+		free(job);
+
+		if (broken) {
+			pthread_mutex_lock(&pool->lock);
+			pool->broken++;
+			pthread_mutex_unlock(&pool->lock);
+		}
+	}
+}
+
+/* start nworkers threads validating recovered JPEGs in the background */
+struct validate_pool *validate_start(int nworkers)
+{
+	struct validate_pool *pool = calloc(1, sizeof(struct validate_pool) + nworkers * sizeof(pthread_t));
+	if (pool == NULL)
+		return NULL;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->ready, NULL);
+
+	for (int i = 0; i < nworkers; i++) {
+		if (pthread_create(&pool->workers[i], NULL, validate_worker, pool) != 0)
+			break;
+		pool->nworkers++;
+	}
+
+	if (pool->nworkers == 0) {
+		free(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+/* queue a recovered JPEG for validation */
+void validate_submit(struct validate_pool *pool, const char *path)
+{
+	size_t len = strlen(path) + 1;
+	struct validate_job *job = malloc(sizeof(struct validate_job) + len);
+	if (job == NULL)
+		return;
+
+	job->next = NULL;
+	memcpy(job->path, path, len);
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->tail)
+		pool->tail->next = job;
+	else
+		pool->head = job;
+	pool->tail = job;
+	pthread_cond_signal(&pool->ready);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* wait for the queue to drain and stop the workers */
+unsigned int validate_finish(struct validate_pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->done = 1;
+	pthread_cond_broadcast(&pool->ready);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->nworkers; i++)
+		pthread_join(pool->workers[i], NULL);
+
+	unsigned int broken = pool->broken;
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->ready);
+	free(pool);
+	return broken;
+}
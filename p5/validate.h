@@ -0,0 +1,32 @@
+#ifndef VALIDATE
+#define VALIDATE
+#include <stddef.h>
+
+/* outcome of checking a recovered JPEG */
+enum jpeg_status {
+	JPEG_OK,                               /* SOI ... SOS ... EOI all present */
+	JPEG_TRUNCATED,                        /* data runs out before EOI */
+	JPEG_BROKEN                            /* not a well formed marker stream */
+};
+
+/* walk the marker segments of a JPEG, setting *end just past EOI when found */
+enum jpeg_status jpeg_validate( const unsigned char *buf,      /* the recovered bytes */
+								size_t               len,      /* how many of them */
+								size_t              *end,      /* where to put the EOI end offset */
+								const char         **reason    /* where to put a description of the problem */
+								);
+
+struct validate_pool;
+
+/* start nworkers threads validating recovered JPEGs in the background */
+struct validate_pool *validate_start( int nworkers);
+
+/* queue a recovered JPEG for validation, it is truncated at EOI if valid */
+void validate_submit( struct validate_pool *pool,
+					  const char           *path
+					  );
+
+/* wait for the queue to drain and stop the workers, returns the number of broken files */
+unsigned int validate_finish( struct validate_pool *pool);
+
+#endif